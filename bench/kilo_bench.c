@@ -0,0 +1,735 @@
+
+
+
+
+
+/* File:	 kilo_bench.c														*/
+/* ====[DESCRIPTION]=========================================================== */
+/* Headless benchmark harness for kilo. It runs the editor under a pseudo-	*/
+/* terminal, feeds it a scripted keystroke workload and times the frames it	*/
+/* draws in response. The results are printed as a single JSON object so	*/
+/* that they can be tracked from one version to the next.					*/
+/*																			*/
+/* Usage: kilo_bench [-s bytes] [-w script] [-o out.json] [-f file] ./kilo	*/
+/*																			*/
+/* Without -f a file of -s bytes (1 GiB by default) is generated and removed	*/
+/* afterwards. Without -w the default workload below is used. A script has	*/
+/* one step per line:														*/
+/*   type <n>		type n characters, with a newline every 60			*/
+/*   page_down <n>	press Page Down n times								*/
+/*   page_up <n>		press Page Up n times								*/
+/*   paste <n>		write n bytes of text to the editor in one go		*/
+/*   save			press Ctrl-S and wait for the save to be reported	*/
+/*   keys <text>	type text as it is, with "\e" for Escape			*/
+/*   expect <text>	redraw until a frame contains text (with "\e" too);	*/
+/*				    the run fails if none does within a minute			*/
+/* ============================================================================ */
+
+
+
+
+
+/* ====[INCLUDES]========================================================================================================= */
+
+
+
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+/* forkpty(), link with -lutil. */
+#include <pty.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+
+
+
+
+/* ====[DEFINES]========================================================================================================== */
+
+
+
+
+
+#define BENCH_DEFAULT_SIZE		(1024LL * 1024 * 1024)
+#define BENCH_ROWS				24
+#define BENCH_COLS				80
+/* Seconds to wait for the file to load, and for any other frame. */
+#define BENCH_LOAD_TIMEOUT		1800
+#define BENCH_FRAME_TIMEOUT		60
+
+/* kilo hides the cursor while it draws a frame and shows it again at the very end. */
+#define FRAME_END				"\x1b[?25h"
+#define FRAME_END_LEN			6
+
+static const char *default_workload =
+	"type 10000\n"
+	"page_down 500\n"
+	"page_up 100\n"
+	"paste 65536\n"
+	"save\n";
+
+
+
+
+
+/* ====[DATA]============================================================================================================= */
+
+
+
+
+
+/* Structure that collects samples (latencies, frame sizes, ...) for percentiles. */
+struct samples
+{
+	double *v;
+	int n;
+	int cap;
+};
+
+/* Structure that holds the editor running under the pseudo-terminal. */
+struct term
+{
+	int fd;
+	pid_t pid;
+
+	/* Output not yet consumed, and the frame being assembled from it. */
+	char in[65536];
+	int inpos;
+	int inlen;
+
+	char *frame;
+	size_t framelen;
+	size_t framecap;
+
+	long frames;
+	struct samples frame_bytes;
+};
+
+/* Structure that holds the results of one kind of workload step. */
+struct step
+{
+	char name[32];
+	struct samples latency_us;
+	long long bytes;
+	double total_ms;
+};
+
+static struct step steps[16];
+static int nsteps = 0;
+
+
+
+
+
+/* ====[FUNCTIONS]======================================================================================================== */
+
+
+
+
+
+/* Function that handles fatal errors. */
+static void die(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+
+
+
+/* Function that returns a monotonic timestamp in microseconds. */
+static double nowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+
+
+
+/* Function responsible for adding a sample. */
+static void sampleAdd(struct samples *s, double v)
+{
+	if (s->n == s->cap)
+	{
+		s->cap = s->cap ? s->cap * 2 : 256;
+		s->v = realloc(s->v, sizeof(double) * s->cap);
+	}
+
+	s->v[s->n++] = v;
+}
+
+
+
+
+static int cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+
+
+/* Function that returns the p-th percentile (0..100) of the samples. */
+static double samplePct(struct samples *s, double p)
+{
+	if (s->n == 0)
+		return 0;
+
+	qsort(s->v, s->n, sizeof(double), cmpDouble);
+
+	int i = (int) ((p / 100.0) * (s->n - 1) + 0.5);
+	return s->v[i];
+}
+
+
+
+
+/* Function responsible for printing a sample set as a JSON object. */
+static void samplePrint(FILE *out, struct samples *s)
+{
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < s->n; i++)
+		sum += s->v[i];
+
+	fprintf(out, "{\"n\": %d, \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+			s->n, s->n ? sum / s->n : 0.0, samplePct(s, 50), samplePct(s, 90),
+			samplePct(s, 99), samplePct(s, 100));
+}
+
+
+
+
+/* Function that returns the results of the step with the given name, creating it. */
+static struct step *stepGet(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nsteps; i++)
+		if (!strcmp(steps[i].name, name))
+			return &steps[i];
+
+	if (nsteps == (int) (sizeof(steps) / sizeof(steps[0])))
+	{
+		fprintf(stderr, "kilo_bench: too many kinds of steps\n");
+		exit(1);
+	}
+
+	snprintf(steps[nsteps].name, sizeof(steps[nsteps].name), "%s", name);
+	return &steps[nsteps++];
+}
+
+
+
+
+/* Function responsible for generating a text file of (about) "size" bytes. */
+static void generateFile(const char *path, long long size)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		die("open");
+
+	char *buf = malloc(1 << 20);
+	long long written = 0;
+	long line = 0;
+
+	while (written < size)
+	{
+		int len = 0;
+
+		while (len < (1 << 20) - 128 && written + len < size)
+		{
+			len += sprintf(&buf[len], "%s\tint v%ld = %ld; /* benchmark line %ld */\n",
+						   (line % 50) ? "" : "/* ---- */", line, line * 7, line);
+			line++;
+		}
+
+		if (write(fd, buf, len) != len)
+			die("write");
+
+		written += len;
+	}
+
+	free(buf);
+	close(fd);
+}
+
+
+
+
+/* Function responsible for starting the editor on "file" under a pseudo-terminal. */
+static void termSpawn(struct term *t, const char *kilo, const char *file)
+{
+	struct winsize ws = { BENCH_ROWS, BENCH_COLS, 0, 0 };
+
+	memset(t, 0, sizeof(*t));
+
+	t->pid = forkpty(&t->fd, NULL, NULL, &ws);
+	if (t->pid == -1)
+		die("forkpty");
+
+	if (t->pid == 0)
+	{
+		setenv("TERM", "xterm", 1);
+		execl(kilo, kilo, file, (char *) NULL);
+		perror("exec");
+		_exit(127);
+	}
+}
+
+
+
+
+/* Function responsible for reading the editor's output until a frame ends that */
+/* contains "marker" (any frame when it is NULL). Returns 0, or -1 when the     */
+/* editor went away or nothing came within "timeout" seconds.                   */
+static int termWaitFrame(struct term *t, const char *marker, int timeout)
+{
+	double deadline = nowUs() + (timeout * 1e6);
+
+	while (1)
+	{
+		while (t->inpos < t->inlen)
+		{
+			char c = t->in[t->inpos++];
+
+			if (t->framelen == t->framecap)
+			{
+				t->framecap = t->framecap ? t->framecap * 2 : 65536;
+				t->frame = realloc(t->frame, t->framecap);
+			}
+
+			t->frame[t->framelen++] = c;
+
+			if (c == 'h' && t->framelen >= FRAME_END_LEN &&
+				!memcmp(&t->frame[t->framelen - FRAME_END_LEN], FRAME_END, FRAME_END_LEN))
+			{
+				int found = (marker == NULL) ||
+							memmem(t->frame, t->framelen, marker, strlen(marker)) != NULL;
+
+				t->frames++;
+				sampleAdd(&t->frame_bytes, t->framelen);
+				t->framelen = 0;
+
+				if (found)
+					return 0;
+			}
+		}
+
+		double left = deadline - nowUs();
+		if (left <= 0)
+			return -1;
+
+		struct pollfd pfd = { t->fd, POLLIN, 0 };
+		if (poll(&pfd, 1, (int) (left / 1000) + 1) <= 0)
+			continue;
+
+		ssize_t n = read(t->fd, t->in, sizeof(t->in));
+		if (n <= 0)
+			return -1;
+
+		t->inpos = 0;
+		t->inlen = n;
+	}
+}
+
+
+
+
+/* Function responsible for consuming whatever the editor drew on its own, e.g. when */
+/* background highlighting finished, so that it is not taken for the next response. */
+static void termDrain(struct term *t)
+{
+	struct pollfd pfd = { t->fd, POLLIN, 0 };
+
+	while (t->inpos < t->inlen || poll(&pfd, 1, 0) > 0)
+	{
+		if (t->inpos >= t->inlen)
+		{
+			ssize_t n = read(t->fd, t->in, sizeof(t->in));
+			if (n <= 0)
+				return;
+
+			t->inpos = 0;
+			t->inlen = n;
+		}
+
+		/* Only whole frames are consumed; a partial one is left for termWaitFrame(). */
+		char *end = memmem(&t->in[t->inpos], t->inlen - t->inpos, FRAME_END, FRAME_END_LEN);
+		if (end == NULL)
+			return;
+
+		termWaitFrame(t, NULL, 0);
+	}
+}
+
+
+
+
+/* Function responsible for sending a key and timing the frame drawn in response. */
+static void termKey(struct term *t, struct step *st, const char *key, const char *marker)
+{
+	termDrain(t);
+
+	double start = nowUs();
+
+	if (write(t->fd, key, strlen(key)) != (ssize_t) strlen(key))
+		die("write");
+
+	if (termWaitFrame(t, marker, BENCH_FRAME_TIMEOUT) == -1)
+	{
+		fprintf(stderr, "kilo_bench: no frame after key in step \"%s\"\n", st->name);
+		exit(1);
+	}
+
+	double us = nowUs() - start;
+
+	sampleAdd(&st->latency_us, us);
+	st->total_ms += us / 1000;
+	st->bytes += strlen(key);
+}
+
+
+
+
+/* Function responsible for writing "n" bytes of text at once, like a terminal paste. */
+/* kilo draws one frame per byte it processes, so the step ends at the n-th frame.    */
+static void termPaste(struct term *t, struct step *st, long n)
+{
+	char *text = malloc(n);
+	long i;
+
+	for (i = 0; i < n; i++)
+		text[i] = ((i % 64) == 63) ? '\r' : 'a' + (i % 26);
+
+	termDrain(t);
+
+	long frames = t->frames;
+	long sent = 0;
+	double start = nowUs();
+
+	/* Keep writing while reading, or the pty buffers fill up in both directions. */
+	while (sent < n || t->frames - frames < n)
+	{
+		if (sent < n)
+		{
+			struct pollfd pfd = { t->fd, POLLOUT, 0 };
+
+			if (poll(&pfd, 1, 0) > 0)
+			{
+				ssize_t w = write(t->fd, &text[sent], (n - sent > 1024) ? 1024 : n - sent);
+				if (w > 0)
+					sent += w;
+			}
+		}
+
+		if (termWaitFrame(t, NULL, BENCH_FRAME_TIMEOUT) == -1)
+		{
+			fprintf(stderr, "kilo_bench: paste stalled\n");
+			exit(1);
+		}
+	}
+
+	double us = nowUs() - start;
+
+	sampleAdd(&st->latency_us, us / n);
+	st->total_ms += us / 1000;
+	st->bytes += n;
+
+	free(text);
+}
+
+
+
+
+/* Function responsible for redrawing with Ctrl-L until a frame contains "marker", */
+/* giving work the editor does in the background a second between redraws.        */
+static void termExpect(struct term *t, const char *marker)
+{
+	int tries;
+
+	for (tries = 0; tries < BENCH_FRAME_TIMEOUT; tries++)
+	{
+		if (write(t->fd, "\x0c", 1) != 1)
+			die("write");
+
+		if (termWaitFrame(t, marker, 1) == 0)
+			return;
+	}
+
+	fprintf(stderr, "kilo_bench: no frame shows \"%s\"\n", marker);
+	exit(1);
+}
+
+
+
+
+/* Function responsible for copying the text argument of a step, turning "\e" into Escape. */
+static void unescape(char *dst, const char *src, size_t size)
+{
+	size_t n = 0;
+
+	while (*src && *src != '\n' && n + 1 < size)
+	{
+		if (src[0] == '\\' && src[1] == 'e')
+		{
+			dst[n++] = '\x1b';
+			src += 2;
+		}
+
+		else
+			dst[n++] = *src++;
+	}
+
+	dst[n] = '\0';
+}
+
+
+
+
+/* Function responsible for running one line of the workload script. */
+static void runStep(struct term *t, const char *line)
+{
+	char cmd[32];
+	long n = 1;
+
+	if (sscanf(line, "%31s %ld", cmd, &n) < 1 || cmd[0] == '#')
+		return;
+
+	struct step *st = stepGet(cmd);
+	char text[256];
+	long i;
+
+	/* The text of "keys" and "expect" is the rest of the line after one blank. */
+	const char *arg = strstr(line, cmd) + strlen(cmd);
+	unescape(text, *arg ? arg + 1 : arg, sizeof(text));
+
+	if (!strcmp(cmd, "type"))
+	{
+		for (i = 0; i < n; i++)
+		{
+			char key[2] = { ((i % 60) == 59) ? '\r' : 'a' + (i % 26), '\0' };
+			termKey(t, st, key, NULL);
+		}
+	}
+
+	else if (!strcmp(cmd, "page_down"))
+		for (i = 0; i < n; i++)
+			termKey(t, st, "\x1b[6~", NULL);
+
+	else if (!strcmp(cmd, "page_up"))
+		for (i = 0; i < n; i++)
+			termKey(t, st, "\x1b[5~", NULL);
+
+	else if (!strcmp(cmd, "paste"))
+		termPaste(t, st, n);
+
+	else if (!strcmp(cmd, "save"))
+		termKey(t, st, "\x13", "written to disk");
+
+	else if (!strcmp(cmd, "keys"))
+	{
+		for (i = 0; text[i]; i++)
+		{
+			char key[2] = { text[i], '\0' };
+			termKey(t, st, key, NULL);
+		}
+	}
+
+	else if (!strcmp(cmd, "expect"))
+		termExpect(t, text);
+
+	else
+	{
+		fprintf(stderr, "kilo_bench: unknown step \"%s\"\n", cmd);
+		exit(1);
+	}
+}
+
+
+
+
+int main(int argc, char *argv[])
+{
+	long long size = BENCH_DEFAULT_SIZE;
+	const char *script = NULL;
+	const char *outpath = NULL;
+	const char *file = NULL;
+	int opt;
+
+	if (getenv("KILO_BENCH_SIZE"))
+		size = atoll(getenv("KILO_BENCH_SIZE"));
+
+	while ((opt = getopt(argc, argv, "s:w:o:f:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's': size = atoll(optarg); break;
+			case 'w': script = optarg; break;
+			case 'o': outpath = optarg; break;
+			case 'f': file = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-s bytes] [-w script] [-o out.json] [-f file] kilo\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s [-s bytes] [-w script] [-o out.json] [-f file] kilo\n", argv[0]);
+		return 2;
+	}
+
+	const char *kilo = argv[optind];
+
+	/* Read the whole workload up front so that it does not disturb the timings. */
+	char *workload;
+
+	if (script)
+	{
+		FILE *fp = fopen(script, "r");
+		if (!fp)
+			die(script);
+
+		size_t cap = 0;
+		workload = NULL;
+		if (getdelim(&workload, &cap, '\0', fp) == -1)
+			workload = strdup("");
+
+		fclose(fp);
+	}
+
+	else
+		workload = strdup(default_workload);
+
+	char genpath[] = "/tmp/kilo_bench.XXXXXX";
+
+	if (file == NULL)
+	{
+		int fd = mkstemp(genpath);
+		if (fd == -1)
+			die("mkstemp");
+
+		close(fd);
+		generateFile(genpath, size);
+		file = genpath;
+	}
+
+	struct stat st;
+	stat(file, &st);
+
+	struct term t;
+	double start = nowUs();
+
+	termSpawn(&t, kilo, file);
+
+	/* The first frame is drawn while the file is still loading; the help message */
+	/* only shows up once it is loaded.                                           */
+	if (termWaitFrame(&t, NULL, BENCH_LOAD_TIMEOUT) == -1)
+	{
+		fprintf(stderr, "kilo_bench: no first frame\n");
+		return 1;
+	}
+
+	double first_frame_ms = (nowUs() - start) / 1000;
+
+	if (termWaitFrame(&t, "HELP:", BENCH_LOAD_TIMEOUT) == -1)
+	{
+		fprintf(stderr, "kilo_bench: file did not finish loading\n");
+		return 1;
+	}
+
+	double load_ms = (nowUs() - start) / 1000;
+
+	char *line = strtok(workload, "\n");
+	while (line)
+	{
+		runStep(&t, line);
+		line = strtok(NULL, "\n");
+	}
+
+	/* Quit and collect the peak RSS of the editor from the kernel. */
+	if (write(t.fd, "\x11", 1) != 1)
+		die("write");
+
+	struct rusage ru;
+	int status;
+
+	while (1)
+	{
+		char buf[4096];
+		struct pollfd pfd = { t.fd, POLLIN, 0 };
+
+		if (wait4(t.pid, &status, WNOHANG, &ru) == t.pid)
+			break;
+
+		/* Keep the pty drained so that the editor can exit. */
+		if (poll(&pfd, 1, 100) > 0 && read(t.fd, buf, sizeof(buf)) <= 0)
+		{
+			wait4(t.pid, &status, 0, &ru);
+			break;
+		}
+	}
+
+	FILE *out = outpath ? fopen(outpath, "w") : stdout;
+	if (!out)
+		die(outpath);
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"file_bytes\": %lld,\n", (long long) st.st_size);
+	fprintf(out, "  \"screen\": \"%dx%d\",\n", BENCH_COLS, BENCH_ROWS);
+	fprintf(out, "  \"time_to_first_frame_ms\": %.1f,\n", first_frame_ms);
+	fprintf(out, "  \"load_ms\": %.1f,\n", load_ms);
+	fprintf(out, "  \"steps\": {\n");
+
+	int i;
+	for (i = 0; i < nsteps; i++)
+	{
+		fprintf(out, "    \"%s\": {\"bytes_sent\": %lld, \"total_ms\": %.1f, \"latency_us\": ",
+				steps[i].name, steps[i].bytes, steps[i].total_ms);
+		samplePrint(out, &steps[i].latency_us);
+		fprintf(out, "}%s\n", (i + 1 < nsteps) ? "," : "");
+	}
+
+	fprintf(out, "  },\n");
+	fprintf(out, "  \"frames\": %ld,\n", t.frames);
+	fprintf(out, "  \"bytes_per_frame\": ");
+	samplePrint(out, &t.frame_bytes);
+	fprintf(out, ",\n");
+	fprintf(out, "  \"peak_rss_kb\": %ld,\n", ru.ru_maxrss);
+	fprintf(out, "  \"exit_status\": %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+	fprintf(out, "}\n");
+
+	if (out != stdout)
+		fclose(out);
+
+	if (file == genpath)
+		unlink(genpath);
+
+	free(workload);
+
+	return 0;
+}
+/* ====[END-OF-FILE]====================================================================================================== */
@@ -41,6 +41,8 @@
 #include <sys/ioctl.h>
 /* Library file that adds additional functionality to types. */
 #include <sys/types.h>
+/* POSIX Library that provides stat(), used to tell whether a journal still matches its file. */
+#include <sys/stat.h>
 /* Standard C Library file that will provide more effective error handling functions. */
 #include <errno.h>
 /* POSIC Library that provides functions to control terminal I/O and signals.   */
@@ -49,6 +51,28 @@
 #include <time.h>
 /* POSIX Library where we can access I/O primative functions such as read, write, etc. */
 #include <unistd.h>
+/* POSIX Library that lets us wait on several file descriptors at once. */
+#include <poll.h>
+/* POSIX threads and semaphores, used by the background highlighter. Link with -pthread. */
+#include <pthread.h>
+#include <semaphore.h>
+/* Standard C Library file that provides the atomics the highlighter hands rows over with. */
+#include <stdatomic.h>
+/* POSIX Library that provides mmap() and memfd_create(), used by the session server. */
+#include <sys/mman.h>
+/* POSIX Libraries for the Unix domain socket the session server listens on. */
+#include <sys/socket.h>
+#include <sys/un.h>
+/* Standard C Library file that provides PATH_MAX and IOV_MAX. */
+#include <limits.h>
+/* POSIX Libraries for running filter commands: signals, waitpid() and writev(). */
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+/* zlib, used to stream gzip-compressed files in and out of the editor. Link with -lz. */
+#include <zlib.h>
+/* The editor core: rows, cursor and the text primitives, see kilo_core.h. */
+#include "kilo_core.h"
 
 
 
@@ -61,7 +85,29 @@
 
 
 #define KILO_VERSION 	"0.0.1"
-#define KILO_TAB_STOP	8
+/* Size of the chunks that editorOpen() reads from disk (or from zlib) at a time. */
+#define KILO_READ_CHUNK	(64 * 1024)
+/* The edit journal is fsync'd once the editor has been idle for KILO_JOURNAL_IDLE_MS, */
+/* and at least every KILO_JOURNAL_MAX_MS while the user keeps typing, or as soon as  */
+/* KILO_JOURNAL_MAX_BYTES are pending, so that a large paste is not held twice.       */
+#define KILO_JOURNAL_IDLE_MS	500
+#define KILO_JOURNAL_MAX_MS		2000
+#define KILO_JOURNAL_MAX_BYTES	(4 * 1024 * 1024)
+#define KILO_JOURNAL_MAGIC		"KILOJRN1"
+/* The hex view shows KILO_HEX_ROW bytes a row. Files with a NUL byte in their first */
+/* KILO_HEX_SNIFF bytes are taken to be binary and opened in it.                     */
+#define KILO_HEX_ROW			16
+#define KILO_HEX_SNIFF			8192
+/* Default memory limit of the undo log, in bytes. */
+#define KILO_UNDO_LIMIT			(16 * 1024 * 1024)
+/* Default memory budget, in bytes, of everything the open files hold. Clean files */
+/* that are not on screen have their rows dropped to stay under it, and are read   */
+/* back from disk when switched to. Set with the KILO_MEM_BUDGET variable.         */
+#define KILO_MEM_BUDGET			(1024LL * 1024 * 1024)
+/* Magic number at the start of the index a session server keeps of a file. */
+#define KILO_SERVER_MAGIC		"KILOIDX2"
+/* How long the session server waits for a client to name its file. */
+#define KILO_SERVER_TIMEOUT_MS	1000
 #define CTRL_KEY(k)		((k) & 0x1f)
 
 
@@ -85,6 +131,47 @@ enum editorKey
 	PAGE_DOWN
 };
 
+/* Enumeration of the highlight classes stored, one byte per column, in row->hl. */
+enum editorHighlight
+{
+	HL_NORMAL = 0,
+	HL_COMMENT,
+	HL_MLCOMMENT,
+	HL_KEYWORD1,
+	HL_KEYWORD2,
+	HL_STRING,
+	HL_NUMBER
+};
+
+/* Flags that select what a syntax highlights. */
+#define HL_HIGHLIGHT_NUMBERS	(1 << 0)
+#define HL_HIGHLIGHT_STRINGS	(1 << 1)
+
+/* The state a row hands over to the next one: nothing, an open block comment, or */
+/* the quote character of a string continued with a trailing backslash.          */
+#define HL_STATE_NONE		0
+#define HL_STATE_COMMENT	1
+
+/* Background highlighting. Files of more than KILO_HL_SYNC_FILE rows are highlighted */
+/* by up to KILO_HL_THREADS worker threads, KILO_HL_CHUNK rows per job with at most  */
+/* KILO_HL_JOBS jobs in flight. An edit re-highlights at most KILO_HL_SYNC_ROWS rows */
+/* itself and leaves the rest of a state change to the workers.                      */
+#define KILO_HL_THREADS		4
+#define KILO_HL_CHUNK		512
+#define KILO_HL_JOBS		16
+#define KILO_HL_SYNC_ROWS	256
+#define KILO_HL_SYNC_FILE	4096
+
+/* Frame timing. The last KILO_TRACE_FRAMES frames are kept in a ring buffer; the */
+/* status bar overlay summarises the last KILO_TRACE_WINDOW of them.              */
+#define KILO_TRACE_FRAMES	4096
+#define KILO_TRACE_WINDOW	256
+
+/* Timestamps are only taken while tracing is on, so that it costs a branch when off. */
+#define TRACE_BEGIN()			(E.trace.enabled ? editorNanos() : 0)
+/* A stage that began while tracing was off (t0 == 0) is not recorded. */
+#define TRACE_END(stage, t0)	do { if (E.trace.enabled && (t0)) editorTraceRecord((stage), (t0)); } while (0)
+
 
 
 
@@ -96,15 +183,338 @@ enum editorKey
 
 
 
-/* Structure that defines what a row of data is. */
-typedef struct erow
+/* Structure that describes how to highlight one type of file. */
+struct editorSyntax
+{
+	char *filetype;
+	/* File extensions (starting with a '.') or name fragments this syntax is used for. */
+	char **filematch;
+	/* Keywords; the ones ending in '|' are highlighted as types. */
+	char **keywords;
+	char *singleline_comment_start;
+	char *multiline_comment_start;
+	char *multiline_comment_end;
+	int flags;
+};
+
+
+
+
+
+/* Enumeration of the operations recorded in the edit journal. */
+enum journalOp
+{
+	/* Insert "len" bytes at (row, col). A row equal to the row count appends a row. */
+	JOURNAL_INSERT = 1,
+	/* Delete "len" bytes at (row, col); the record carries no text. */
+	JOURNAL_DELETE
+};
+
+/* Header written at the start of every journal. It identifies the version of the */
+/* file on disk that the recorded edits apply to.                                 */
+struct journalHeader
+{
+	char magic[8];
+	long long size;
+	/* In nanoseconds, as in E.disk_mtime. */
+	long long mtime;
+};
+
+/* Every record is followed by "len" bytes of text. */
+struct journalRecord
+{
+	int op;
+	int row;
+	int col;
+	int len;
+};
+
+/* Enumeration of the operations kept in the undo log. */
+enum undoOp
+{
+	UNDO_INSERT = 1,
+	UNDO_DELETE
+};
+
+/* One entry of the undo log: "len" bytes of "text" inserted at or deleted from */
+/* (row, col). Consecutive entries with the same group are undone together.    */
+struct undoEntry
+{
+	int op;
+	int row;
+	int col;
+	int len;
+	char *text;
+	int group;
+};
+
+/* Structure that holds the undo log. Entries below "pos" can be undone, the ones  */
+/* from "pos" on redone. "bytes" is what the log costs and is kept under "limit". */
+struct editorUndo
+{
+	struct undoEntry *entries;
+	int n;
+	int cap;
+	int pos;
+	size_t bytes;
+	size_t limit;
+	/* Group of the next entry, and whether a batch is open so entries share it. */
+	int group;
+	int batch;
+	/* Set when the next edit must not be merged into the previous entry. */
+	int sealed;
+	/* Set while the log itself is editing the rows. */
+	int applying;
+	/* Where the text of the last entry ends, when it is an insertion, or -1. */
+	int endrow;
+	int endcol;
+	/* Group whose edits are no longer recorded, because they did not fit. */
+	int lost;
+};
+
+/* Enumeration of the states of a background highlighting job. */
+enum hlJobState
+{
+	HLJOB_FREE = 0,
+	HLJOB_QUEUED,
+	HLJOB_DONE
+};
+
+/* A chunk of rows handed to a highlighting worker. The worker only ever sees the */
+/* copy of the rows' render in "text" (each row NULL terminated, starting at     */
+/* offsets[i]) and writes into "hl" and "states"; it never touches E.buf.row.        */
+struct hlJob
+{
+	_Atomic int state;
+	unsigned int epoch;
+	int start;
+	int n;
+	int state_in;
+	struct editorSyntax *syntax;
+
+	char *text;
+	unsigned char *hl;
+	int textcap;
+
+	int *offsets;
+	unsigned int *versions;
+	int *states;
+	int rowcap;
+};
+
+/* Structure that holds the background highlighter. */
+struct editorHighlighter
+{
+	int nthreads;
+	pthread_t threads[KILO_HL_THREADS];
+	/* Posted once per queued job. The n-th post is for the job in slot n % KILO_HL_JOBS, */
+	/* which is why jobs are always queued in slot order.                                 */
+	sem_t work;
+	_Atomic unsigned int claimed;
+	unsigned int issued;
+	struct hlJob jobs[KILO_HL_JOBS];
+	/* Workers write a byte here when a job is done, to wake the input loop. */
+	int wakefd[2];
+	/* Bumped when rows are added or removed, which makes every job in flight stale. */
+	unsigned int epoch;
+	/* First row that may still need the workers, and how many rows are not ready. */
+	int scan;
+	int unready;
+	/* Set while a file is loading: rows are left for editorHighlightStart(). */
+	int defer;
+};
+
+/* Enumeration of the stages of a frame that are timed. */
+enum traceStage
+{
+	/* Turning the bytes of a key press into a key (editorReadKey). */
+	TRACE_DECODE = 0,
+	/* Applying the key (editorProcessKeypress). */
+	TRACE_EDIT,
+	TRACE_SCROLL,
+	/* Building the frame (editorDrawRows, editorDrawStatusBar, ...). */
+	TRACE_BUILD,
+	TRACE_WRITE,
+	TRACE_STAGES
+};
+
+/* One frame in the trace ring: when each stage started and how long it took, in ns. */
+/* A frame holds the key that led to it as well as the drawing of it.               */
+struct traceFrame
+{
+	long long start[TRACE_STAGES];
+	long long dur[TRACE_STAGES];
+};
+
+/* Structure that holds the frame timing instrumentation. */
+struct editorTrace
+{
+	int enabled;
+	/* Set while the p50/p99 overlay replaces the left of the status bar. */
+	int overlay;
+	/* Where to dump the ring as a Chrome trace on exit, from KILO_TRACE. */
+	char *path;
+	struct traceFrame *ring;
+	long long frames;
+	struct traceFrame cur;
+};
+
+/* Structure that holds the memory accounting. The row buffers are tracked by the */
+/* buffer as they are allocated and freed (see kiloBuffer); the rest is small     */
+/* enough to be added up when a report is asked for.                              */
+struct editorMemory
+{
+	/* The last frame built, the biggest one so far, and buffers that only live for */
+	/* the duration of an operation (the copy of the text built by a save).         */
+	size_t frame;
+	size_t frame_peak;
+	size_t transient;
+	/* High-water mark of everything tracked. */
+	size_t peak;
+};
+
+/* Structure that holds the folds. A folded row keeps the number of rows folded  */
+/* away under it in its "fold", so folds move along with the rows. The trees are */
+/* built from those and tell how many rows up to a row are hidden in O(log n),   */
+/* which is what screen rows and file rows are translated with.                  */
+struct editorFolds
+{
+	/* Range update, range query Fenwick pair over the rows, from 1: of the first */
+	/* i rows, i * sum(b1, i) - sum(b2, i) are hidden. "n" rows, room for "cap".  */
+	long long *b1;
+	long long *b2;
+	int n;
+	int cap;
+	/* Number of folded rows. While it is 0 nothing is hidden and the trees are unused. */
+	int count;
+	/* Set when rows moved, so the trees must be built again before they are used. */
+	int stale;
+};
+
+/* Structure that holds a byte typed over in the hex view, until it is written. */
+struct hexEdit
+{
+	long long off;
+	unsigned char byte;
+};
+
+/* Structure that holds the hex view of a file. The file is mapped rather than   */
+/* read, and row r of the view is the KILO_HEX_ROW bytes from r * KILO_HEX_ROW   */
+/* on, so there is no row array and a file of any size opens in the same time    */
+/* and memory. Bytes typed over are kept aside, sorted by offset, until they are */
+/* written back in place.                                                        */
+struct editorHex
+{
+	int on;
+	int fd;
+	int writable;
+	unsigned char *map;
+	long long size;
+	/* The byte under the cursor, which of its two digits, and the first row shown. */
+	long long cur;
+	int nibble;
+	long long top;
+	struct hexEdit *edits;
+	int nedits;
+	int cap;
+};
+
+/* Structure that holds the state of the crash-recovery journal. */
+struct editorJournal
+{
+	int fd;
+	char *path;
+	/* Records that have not been written and fsync'd yet. "last" is the offset */
+	/* of the newest of them, so that consecutive keystrokes can be merged.    */
+	char *buf;
+	int len;
+	int cap;
+	int last;
+	long long last_edit;
+	long long last_sync;
+	/* Set while the journal is being replayed, so that replay isn't journaled. */
+	int replaying;
+};
+
+
+/* Structure at the start of the index a session server keeps of a file, in a */
+/* sealed memfd it hands to clients. Offsets are from the start of the index. */
+struct serverIndex
+{
+	char magic[8];
+	int gzip;
+	int pad;
+	/* Modification time, in ns, and size of the file the index was built from. */
+	long long mtime;
+	long long disk_size;
+	/* The text of the file, "size" bytes at offset "text", and nrows + 1 line */
+	/* starts at offset "lines"; the last one is one past the end of the text. */
+	long long size;
+	long long text;
+	long long nrows;
+	long long lines;
+};
+
+/* Structure that the session server answers with. The index itself comes along */
+/* as a file descriptor when status is 0; otherwise err is the errno.           */
+struct serverReply
+{
+	int status;
+	int err;
+};
+
+/* Structure that holds an index the session server keeps, and the version of */
+/* the file it was built from.                                                */
+struct serverEntry
+{
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	long long mtime;
+	int fd;
+};
+
+/* Structure that holds an open file while it is not the one on screen. Switching */
+/* files swaps this with the state in E, so the rest of the editor only sees E.   */
+struct editorFile
 {
-	int size;
-	int rsize;
+	struct kiloBuffer buf;
+	int rx;
+	int rowoff;
+	int coloff;
+	char *filename;
+	struct editorSyntax *syntax;
+	int gzip;
+	off_t disk_size;
+	long long disk_mtime;
+	struct editorJournal journal;
+	struct editorUndo undo;
+	char *shared;
+	size_t shared_len;
+	int mark;
+	int folds;
+	struct editorHex hex;
+	/* Rows the background highlighter had not got to yet. */
+	int unready;
+	/* Set while the rows are not in memory, because the file has not been looked */
+	/* at yet or was dropped to stay under the budget. The cursor is kept.        */
+	int evicted;
+	/* When the file was last on screen, so that the least recent goes first. */
+	long long viewed;
+};
 
-	char *chars;
-	char *render;
-}erow;
+/* Structure that holds the list of open files. The entry of the file on screen */
+/* is a placeholder: its state is in E for as long as it is on screen.          */
+struct editorFiles
+{
+	struct editorFile *list;
+	int n;
+	int cur;
+	/* What every open file together may hold, see KILO_MEM_BUDGET. */
+	size_t budget;
+	long long clock;
+};
 
 
 
@@ -113,8 +523,8 @@ typedef struct erow
 /* Structure that will be used as a template for global state */
 struct editorConfig
 {
-	/* cx and cy will be used to control the cursor position. */
-	int cx, cy;
+	/* The rows of the open file and the cursor. */
+	struct kiloBuffer buf;
 	/* rx represents the render's temp. horizontal position.*/
 	int rx;
 	/* rowoff is the "row offset". */
@@ -123,16 +533,40 @@ struct editorConfig
 	int coloff;
 	int screenrows;
 	int screencols;
-	int numrows;
-	
-	erow *row;
 	/* This pointer is where the filename will be stored. */
 	char *filename;
+	/* Syntax used to highlight the file, or NULL for plain text. */
+	struct editorSyntax *syntax;
+	/* Set when the file on disk is gzip-compressed, so that it is saved back compressed. */
+	int gzip;
+	/* Size and modification time of the file when it was last loaded or saved. */
+	off_t disk_size;
+	long long disk_mtime;
+	/* The session server's index of the file that the rows point into, when the */
+	/* file was attached to rather than read; see editorAttach().                */
+	char *shared;
+	size_t shared_len;
+	/* Row set with Ctrl-B where the range filtered with Ctrl-R or copied with */
+	/* Ctrl-C starts, or -1.                                                   */
+	int mark;
+	/* Rows last copied or cut, for every open file to paste; NULL until then. */
+	struct kiloClip *clip;
+	/* Set by "kilo --hex", which opens every file in the hex view. */
+	int hexall;
 	/* These pointers will be responsible for storeing messages to be displayed on the */
 	/* Status bar, along with the current system time.								   */
 	char statusmsg[80];
 	time_t statusmsg_time;
 
+	struct editorJournal journal;
+	struct editorUndo undo;
+	struct editorHighlighter hl;
+	struct editorTrace trace;
+	struct editorMemory mem;
+	struct editorFiles files;
+	struct editorFolds fold;
+	struct editorHex hex;
+
 	struct termios orig_termios;
 };
 
@@ -142,9 +576,60 @@ struct editorConfig E;
 
 
 
+/* The highlight database: the syntaxes kilo knows about. */
+char *C_HL_extensions[] = { ".c", ".h", ".cpp", ".cc", ".hpp", NULL };
+char *C_HL_keywords[] =
+{
+	"switch", "if", "while", "for", "break", "continue", "return", "else", "struct",
+	"union", "typedef", "static", "enum", "class", "case", "default", "do", "goto",
+	"sizeof", "const", "volatile", "extern", "#include", "#define", "#if", "#ifdef",
+	"#ifndef", "#endif", "#else",
+
+	"int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|", "void|",
+	"short|", "size_t|", "ssize_t|", "off_t|",
+	NULL
+};
+
+struct editorSyntax HLDB[] =
+{
+	{
+		"c",
+		C_HL_extensions,
+		C_HL_keywords,
+		"//", "/*", "*/",
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+	},
+};
+
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
+
+
+
 
 /* ====[PROTOTYPES]======================================================================================================= */
 void editorSetStatusMessage(const char *fmt, ...);
+void editorRefreshScreen();
+void editorJournalReset();
+void editorJournalDiscard(struct editorJournal *j);
+void editorJournalRecord(int op, int row, int col, const char *s, int len);
+void editorJournalIdle();
+void editorHighlightIdle();
+void editorJournalFlush();
+void editorUndoRecord(int op, int row, int col, const char *s, int len);
+void editorUndoTake(int op, int row, int col, char *text, int len);
+int editorUndoWanted();
+int editorUndoFits(int len);
+void editorHighlightDefer(int at);
+long long editorNanos();
+void editorMemAdjust(size_t *counter, size_t oldsize, size_t newsize);
+void editorTraceRecord(int stage, long long t0);
+int editorAttach(const char *filename);
+size_t editorFilesMem();
+void editorFilesTrim();
+int editorHexOpen(const char *filename);
+void editorHexClose(struct editorHex *h);
+char *editorPrompt(const char *prompt);
 
 
 
@@ -162,6 +647,9 @@ void terminate(const char *s)
 	write(STDOUT_FILENO, "\x1b[2J", 4);
 	write(STDOUT_FILENO, "\x1b[H", 3);
 
+	/* Whatever has been typed so far should survive the crash. */
+	editorJournalFlush();
+
 	perror(s);
 	exit(1);
 }
@@ -226,17 +714,10 @@ void enableRawMode()
 
 
 
-/* Function responsible for handling keyboard input. */
-int editorReadKey()
+/* Function responsible for turning the first byte of a key press, and whatever */
+/* escape sequence follows it, into a key.                                      */
+int editorDecodeKey(char c)
 {
-	int nread;
-	char c;
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
-	{
-		if (nread == -1 && errno != EAGAIN)
-			terminate("read");
-	}
-
 	/* This IF-ELSE structure essentially aliases the arrow keys as WASD keys. */
 	/* NOTE: This is entirely temporary, as anyone with sense could imagine... */
 	if (c == '\x1b')
@@ -268,7 +749,7 @@ int editorReadKey()
 						case '5':
 							return PAGE_UP;
 						case '6':
-							return PAGE_UP;
+							return PAGE_DOWN;
 						case '7':
 							return HOME_KEY;
 						case '8':
@@ -317,6 +798,32 @@ int editorReadKey()
 
 
 
+/* Function responsible for handling keyboard input. */
+int editorReadKey()
+{
+	int nread;
+	char c;
+	while ((nread = read(STDIN_FILENO, &c, 1)) != 1)
+	{
+		if (nread == -1 && errno != EAGAIN)
+			terminate("read");
+
+		/* read() times out every tenth of a second, which gives us an idle timer. */
+		editorJournalIdle();
+		editorHighlightIdle();
+	}
+
+	/* Waiting for the user is not part of the frame; decoding what they typed is. */
+	long long t0 = TRACE_BEGIN();
+	int key = editorDecodeKey(c);
+	TRACE_END(TRACE_DECODE, t0);
+
+	return key;
+}
+
+
+
+
 
 /* Function responsible for configuring/getting the cursor position. */
 int getCursorPosition(int *rows, int *cols)
@@ -386,503 +893,4816 @@ int getWindowSize(int *rows, int *cols)
 
 
 
-/* Function responsible for translating the text relative to the cursor position to */
-/* the frame relative to the render target.											*/
-int editorRowCxToRx(erow *row, int cx)
+/* Function that tells whether a character ends a word, for keyword and number matching. */
+int is_separator(int c)
 {
-	int rx = 0;
-	int j;
-
-	for (j = 0; j < cx; j++)
-	{
-		if (row->chars[j] == '\t')
-			rx += ((KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP));
-		
-		rx++;
-	}
-	return rx;
+	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];{}&|!^:?", c) != NULL;
 }
 
 
 
 
-
-/* Function that is responsible for rendering the contents of a row. */
-void editorUpdateRow(erow *row)
+/* Function responsible for highlighting one rendered row. It only looks at the row */
+/* itself and at the state handed over by the previous row, so it can run on any   */
+/* copy of the row. Returns the state to hand over to the next row.                */
+int editorHighlightRow(struct editorSyntax *syntax, const char *render, int rsize,
+					   unsigned char *hl, int state)
 {
-	int j;
-	int tabs = 0;
-	/* idx will contain the number of characters we will be copying into */
-	/* row->render.														 */
-	int idx = 0;
-
-	/* Calculate the amount of tabs on the current line.*/
-	for (j = 0; j < row->size; j++)
-		if (row->chars[j] == '\t')
-			tabs++;
-
-	free(row->render);
-	row->render = malloc(row->size + ((tabs * (KILO_TAB_STOP - 1)) + 1));
-	
-	/* Now render the tabs detected as a series of spaces. */
-	for (j = 0; j < row->size; j++)
-		if (row->chars[j] == '\t')
-		{
-			row->render[idx++] = ' ';
+	memset(hl, HL_NORMAL, rsize);
 
-			while ((idx % KILO_TAB_STOP) != 0)
-				row->render[idx++] = ' ';
-		}
+	if (syntax == NULL)
+		return HL_STATE_NONE;
 
-		else
-			row->render[idx++] = row->chars[j];
+	char **keywords = syntax->keywords;
+	char *scs = syntax->singleline_comment_start;
+	char *mcs = syntax->multiline_comment_start;
+	char *mce = syntax->multiline_comment_end;
 
-	row->render[idx] = '\0';
-	row->rsize = idx;
-}
+	int scs_len = scs ? strlen(scs) : 0;
+	int mcs_len = mcs ? strlen(mcs) : 0;
+	int mce_len = mce ? strlen(mce) : 0;
 
+	int prev_sep = 1;
+	int in_string = (state > HL_STATE_COMMENT) ? state : 0;
+	int in_comment = (state == HL_STATE_COMMENT);
+	int i = 0;
 
+	while (i < rsize)
+	{
+		/* Unsigned: UTF-8 bytes are above 0x7f, and <ctype.h> wants them non-negative. */
+		unsigned char c = render[i];
+		unsigned char prev_hl = (i > 0) ? hl[i - 1] : HL_NORMAL;
 
+		if (scs_len && !in_string && !in_comment && !strncmp(&render[i], scs, scs_len))
+		{
+			memset(&hl[i], HL_COMMENT, rsize - i);
+			break;
+		}
 
+		if (mcs_len && mce_len && !in_string)
+		{
+			if (in_comment)
+			{
+				hl[i] = HL_MLCOMMENT;
 
-/* Function similar to abAppend() in that it is responsible for */
-/* as the name implies, appending a row of text. With that,     */
-/* That means that this function must also be incharge of       */
-/* memory resource allocation.									*/
-void editorAppendRow(char *s, size_t len)
-{
-	/* Reallocate the memory of the row to enough space for appending. */
-	E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
+				if (!strncmp(&render[i], mce, mce_len))
+				{
+					memset(&hl[i], HL_MLCOMMENT, mce_len);
+					i += mce_len;
+					in_comment = 0;
+					prev_sep = 1;
+				}
 
-	/* Here, "at" will represent the reallocation target row. */
-	int at = E.numrows;
-	
-	E.row[at].size = len;
-	E.row[at].chars = malloc(len + 1);
+				else
+					i++;
 
-	/* Transfer the old + new data into the newly reallocated row. */	
-	memcpy(E.row[at].chars, s, len);
-	
-	/* Append an EOF at the end of the row, and move on to the next. */
-	E.row[at].chars[len] = '\0';
-	
-	E.row[at].rsize = 0;
-	E.row[at].render = NULL;
+				continue;
+			}
 
-	editorUpdateRow(&E.row[at]);
+			else if (!strncmp(&render[i], mcs, mcs_len))
+			{
+				memset(&hl[i], HL_MLCOMMENT, mcs_len);
+				i += mcs_len;
+				in_comment = 1;
+				continue;
+			}
+		}
 
-	E.numrows++;
-}
+		if (syntax->flags & HL_HIGHLIGHT_STRINGS)
+		{
+			if (in_string)
+			{
+				hl[i] = HL_STRING;
 
+				if (c == '\\' && i + 1 < rsize)
+				{
+					hl[i + 1] = HL_STRING;
+					i += 2;
+					continue;
+				}
 
+				if (c == in_string)
+					in_string = 0;
 
+				i++;
+				prev_sep = 1;
+				continue;
+			}
 
-/* Function that handles row insert. */
-void editorRowInsertChar(erow *row, int at, int c)
-{
-	/* Check the position/bounds of at relative to the length of the row. */
-	if (at < 0 || at > row->size)
-		at = row->size;
+			else if (c == '"' || c == '\'')
+			{
+				in_string = c;
+				hl[i] = HL_STRING;
+				i++;
+				continue;
+			}
+		}
 
-	/* Reallocate the memory resources for the evaluated row of characters. */
-	/* Here we incremented by two so as to make room for the NULL byte.     */
-	row->chars = realloc(row->chars, row->size + 2);
+		if (syntax->flags & HL_HIGHLIGHT_NUMBERS)
+		{
+			if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
+				(c == '.' && prev_hl == HL_NUMBER))
+			{
+				hl[i] = HL_NUMBER;
+				i++;
+				prev_sep = 0;
+				continue;
+			}
+		}
 
-	/* Shift the positioning of the chars in the row to the right by 1. */
-	memmove(&row->chars[at + 1], &row->chars[at], row->size - (at + 1));
+		if (prev_sep)
+		{
+			int j;
 
-	/* Increase the length of the row. */
-	row->size++;
-	/* Set the at_th index of the chars buffer to the value of c/the char */
-	/* to be inserted into the row buffer at the at_th position.          */
-	row->chars[at] = c;
-	editorUpdateRow(row);
-}
+			for (j = 0; keywords[j]; j++)
+			{
+				int klen = strlen(keywords[j]);
+				int kw2 = keywords[j][klen - 1] == '|';
 
-/* Function responsible for fetching the keyboard presses to be processed. */
-void editorInsertChar(int c)
-{
-	if (E.cy == E.numrows)
-	{
-		editorAppendRow("", 0);
+				if (kw2)
+					klen--;
+
+				if (i + klen <= rsize && !strncmp(&render[i], keywords[j], klen) &&
+					(i + klen == rsize || is_separator((unsigned char) render[i + klen])))
+				{
+					memset(&hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+					i += klen;
+					break;
+				}
+			}
+
+			if (keywords[j] != NULL)
+			{
+				prev_sep = 0;
+				continue;
+			}
+		}
+
+		prev_sep = is_separator(c);
+		i++;
 	}
 
-	/* Call the routine responsible for processing characters to be inserted. */
-	editorRowInsertChar(&E.row[E.cy], E.cx, c);
-	/* Move the cursor position to the next place.in the row. Move the cursor's */
-	/* X-position forward by 1 place.                                           */
-	E.cx++;
-}
+	if (in_comment)
+		return HL_STATE_COMMENT;
 
-/* Function responsible for handling writes to system disk/mass-storage-devices. */
-char *editorRowsToString(int *buflen)
-{
-	int totlen = 0;
-	int j;
+	/* A string only carries on to the next row after a trailing backslash. */
+	if (in_string && rsize > 0 && render[rsize - 1] == '\\')
+		return in_string;
 
-	/* Calculate the size of the file. */
-	for (j = 0; j < E.numrows; j++)
-		totlen += E.row[j].size + 1;
-	
-	/* The length of the file buffer is equal to the calculated "total" length. */
-	*buflen = totlen;
+	return HL_STATE_NONE;
+}
 
-	/* Allocate the space for the file-to-storage buffer. */
-	char *buf = malloc(totlen);
-	char *p = buf;
 
-	for (j = 0; j < E.numrows; j++)
-	{
-		memcpy(p, E.row[j].chars, E.row[j].size);
 
-		/* Advance the storage access buffer forward to the next row. */
-		p += E.row[j].size;
-		*p = '\n';
-		p++;
-	}
 
-	/* The expected caller is free(). */
-	return buf;
+/* Function responsible for flagging a row as highlighted or not, keeping count of */
+/* the rows the background highlighter still has to get to.                        */
+void editorRowSetReady(erow *row, int ready)
+{
+	if (row->hl_ready == ready)
+		return;
+
+	row->hl_ready = ready;
+	E.hl.unready += ready ? -1 : 1;
 }
 
 
 
 
-/* Function responsible for handling file I/O. */
-void editorOpen(char *filename)
+/* Function responsible for highlighting a row after it changed. The state it hands */
+/* over is only pushed down to the following rows for as long as it differs from   */
+/* what they were last highlighted with, so an edit costs O(1) rows unless it opens */
+/* or closes a block comment. Even then at most KILO_HL_SYNC_ROWS rows are done     */
+/* here; the rest is left to the background highlighter.                            */
+void editorUpdateSyntax(erow *row)
 {
-	/* Make a copy of the string containing the file's name. */
-	free(E.filename);
-	E.filename = strdup(filename);
-
-	/* Open the file specified and check incase there is none. */
-	FILE *fp = fopen(filename, "r");
-	if (!fp)
-		terminate("fopen");
+	int at = row - E.buf.row;
+	int budget = KILO_HL_SYNC_ROWS;
 
-	char *line = NULL;
-	size_t linecap = 0;
-	ssize_t linelen;
+	/* Without the state of the previous row there is nothing to start from yet. */
+	if (E.hl.defer || (at > 0 && !E.buf.row[at - 1].hl_ready))
+	{
+		editorHighlightDefer(at);
+		return;
+	}
 
-	while ( (linelen = getline(&line, &linecap, fp)) != -1)
+	while (at < E.buf.numrows && E.buf.row[at].render != NULL)
 	{
-		while (linelen > 0 && (line[linelen - 1] == '\n' ||
-							   line[linelen - 1] == '\r'))
-			linelen--;
+		if (budget-- == 0)
+		{
+			editorHighlightDefer(at);
+			break;
+		}
+
+		erow *r = &E.buf.row[at];
+		int in = (at > 0) ? E.buf.row[at - 1].hl_state : HL_STATE_NONE;
+		int out = editorHighlightRow(E.syntax, r->render, r->rsize, r->hl, in);
 
-		editorAppendRow(line, linelen);
+		editorRowSetReady(r, 1);
+
+		/* The next row was highlighted with this very state: nothing more to do. */
+		if (out == r->hl_state)
+			break;
 
+		r->hl_state = out;
+		at++;
 	}
+}
 
-	free(line);
-	fclose(fp);
+
+
+
+/* Function that maps a highlight class to an ANSI foreground colour. */
+int editorSyntaxToColor(int hl)
+{
+	switch (hl)
+	{
+		case HL_COMMENT:
+		case HL_MLCOMMENT:
+			return 36;
+		case HL_KEYWORD1:
+			return 33;
+		case HL_KEYWORD2:
+			return 32;
+		case HL_STRING:
+			return 35;
+		case HL_NUMBER:
+			return 31;
+		default:
+			return 37;
+	}
 }
 
 
 
 
-/* Function that is responsible for writing to disk. */
-void editorSave()
+/* Function responsible for picking the syntax of the file from its name. A trailing */
+/* ".gz" is looked through, so that "foo.c.gz" is still highlighted as C.           */
+void editorSelectSyntaxHighlight()
 {
-	/* Check if the file being written is a newfile. */
-	if (E.filename == NULL) 
+	E.syntax = NULL;
+
+	if (E.filename == NULL)
 		return;
 
-	int len;
+	char *name = strdup(E.filename);
+	char *ext = strrchr(name, '.');
 
-	/* Our write buffer size will be equal to the value returned by... */
-	char *buf = editorRowsToString(&len);
+	if (ext && !strcmp(ext, ".gz"))
+	{
+		*ext = '\0';
+		ext = strrchr(name, '.');
+	}
 
-	/* Open a file. If it already exists, then open it for writes. If it does not, */
-	/* Create a new file, under thant file name, with read/write permission.       */
-	int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+	unsigned int j;
 
-	/* Error checking before final write to disk. */
-	if (fd != -1)
+	for (j = 0; j < HLDB_ENTRIES && E.syntax == NULL; j++)
 	{
-		if(ftruncate(fd, len) != -1)
-		{
-			if(write(fd, buf, len) == len)
-			{
-				close(fd);
-				free(buf);
+		struct editorSyntax *s = &HLDB[j];
+		int i;
 
-				editorSetStatusMessage("%d bytes written to disk", len);
+		for (i = 0; s->filematch[i]; i++)
+		{
+			int is_ext = (s->filematch[i][0] == '.');
 
-				return;
-			}	
+			if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+				(!is_ext && strstr(name, s->filematch[i])))
+			{
+				E.syntax = s;
+				break;
+			}
 		}
-		close(fd);
 	}
 
-	free(buf);
-
-	editorSetStatusMessage("Can't save ! I/O error: %s", strerror(errno));
+	free(name);
 }
 
 
 
 
-/* structure that defines our append buffer. Creates a dynamic/mutable string type. */
-struct abuf
+/* Function run by the background highlighting workers. Each one claims the jobs */
+/* in the order they were queued, highlights its copy of the rows and publishes */
+/* the result by flipping the job's state with release semantics.               */
+void *editorHighlightWorker(void *arg)
 {
-	char *b;
-	int len;
-};
+	(void) arg;
 
-/* This defines works as a contructor would in C++. The constant definition defines */
-/* what exactly an empty buffer is.													*/
-#define ABUF_INIT {NULL, 0}
+	while (1)
+	{
+		if (sem_wait(&E.hl.work) == -1)
+			continue;
 
+		unsigned int n = atomic_fetch_add(&E.hl.claimed, 1);
+		struct hlJob *job = &E.hl.jobs[n % KILO_HL_JOBS];
+		int state = job->state_in;
+		int i;
 
+		for (i = 0; i < job->n; i++)
+		{
+			int off = job->offsets[i];
+			int len = job->offsets[i + 1] - off - 1;
 
+			state = editorHighlightRow(job->syntax, &job->text[off], len, &job->hl[off], state);
+			job->states[i] = state;
+		}
 
+		atomic_store_explicit(&job->state, HLJOB_DONE, memory_order_release);
 
-/* Function that defines append operations on the append buffer/"abuf". */
-void abAppend(struct abuf *ab, const char *s, int len)
+		/* Wake the input loop up; if the pipe is full it is awake already. */
+		if (write(E.hl.wakefd[1], "", 1) == -1)
+			continue;
+	}
+
+	return NULL;
+}
+
+
+
+
+/* Function responsible for starting the worker threads, the first time they are needed. */
+void editorHighlightStartWorkers()
 {
-	char *new = realloc(ab->b, ab->len + len);
+	if (E.hl.nthreads)
+		return;
 
-	if (new == NULL)
+	if (pipe2(E.hl.wakefd, O_NONBLOCK | O_CLOEXEC) == -1 || sem_init(&E.hl.work, 0, 0) == -1)
+		terminate("highlighter");
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int n = (ncpu > 1) ? ncpu - 1 : 1;
+
+	if (n > KILO_HL_THREADS)
+		n = KILO_HL_THREADS;
+
+	for (E.hl.nthreads = 0; E.hl.nthreads < n; E.hl.nthreads++)
+		if (pthread_create(&E.hl.threads[E.hl.nthreads], NULL, editorHighlightWorker, NULL) != 0)
+			break;
+
+	if (E.hl.nthreads == 0)
+		terminate("pthread_create");
+}
+
+
+
+
+/* Function responsible for leaving row "at" to the background highlighter. */
+void editorHighlightDefer(int at)
+{
+	if (at >= E.buf.numrows)
 		return;
 
-	memcpy(&new[ab->len], s, len);
-	ab->b = new;
-	ab->len += len;
+	editorRowSetReady(&E.buf.row[at], 0);
+
+	if (at < E.hl.scan)
+		E.hl.scan = at;
+}
+
+
+
+
+/* Function responsible for noting that rows were added or removed at "at": the */
+/* jobs in flight refer to rows by index, so none of them can be used any more. */
+void editorHighlightShift(int at)
+{
+	E.hl.epoch++;
+
+	if (at < E.hl.scan)
+		E.hl.scan = at;
+}
+
+
+
+
+/* Function responsible for queueing jobs for the rows that are not ready, for as */
+/* long as there are free slots. Only the queueing thread touches the rows.       */
+void editorHighlightDispatch()
+{
+	while (E.hl.unready > 0 && E.syntax != NULL)
+	{
+		struct hlJob *job = &E.hl.jobs[E.hl.issued % KILO_HL_JOBS];
+
+		if (atomic_load_explicit(&job->state, memory_order_acquire) != HLJOB_FREE)
+			break;
+
+		while (E.hl.scan < E.buf.numrows && E.buf.row[E.hl.scan].hl_ready)
+			E.hl.scan++;
+
+		if (E.hl.scan >= E.buf.numrows)
+			break;
+
+		editorHighlightStartWorkers();
+
+		int start = E.hl.scan;
+		int n = E.buf.numrows - start;
+		int textlen = 0;
+		int i;
+
+		if (n > KILO_HL_CHUNK)
+			n = KILO_HL_CHUNK;
+
+		/* Attached rows are rendered as the highlighter gets to them. */
+		for (i = 0; i < n; i++)
+			kiloRowRender(&E.buf, &E.buf.row[start + i]);
+
+		for (i = 0; i < n; i++)
+			textlen += E.buf.row[start + i].rsize + 1;
+
+		if (textlen > job->textcap)
+		{
+			job->textcap = textlen * 2;
+			job->text = realloc(job->text, job->textcap);
+			job->hl = realloc(job->hl, job->textcap);
+		}
+
+		if (n + 1 > job->rowcap)
+		{
+			job->rowcap = KILO_HL_CHUNK + 1;
+			job->offsets = realloc(job->offsets, sizeof(int) * job->rowcap);
+			job->versions = realloc(job->versions, sizeof(unsigned int) * job->rowcap);
+			job->states = realloc(job->states, sizeof(int) * job->rowcap);
+		}
+
+		int off = 0;
+
+		for (i = 0; i < n; i++)
+		{
+			erow *row = &E.buf.row[start + i];
+
+			job->offsets[i] = off;
+			job->versions[i] = row->version;
+			memcpy(&job->text[off], row->render, row->rsize + 1);
+			off += row->rsize + 1;
+		}
+
+		job->offsets[n] = off;
+		job->start = start;
+		job->n = n;
+		job->epoch = E.hl.epoch;
+		job->syntax = E.syntax;
+
+		/* A guess when the previous row is still pending; checked when collecting. */
+		job->state_in = (start > 0 && E.buf.row[start - 1].hl_ready) ?
+						E.buf.row[start - 1].hl_state : HL_STATE_NONE;
+
+		atomic_store_explicit(&job->state, HLJOB_QUEUED, memory_order_relaxed);
+		E.hl.issued++;
+		E.hl.scan = start + n;
+
+		sem_post(&E.hl.work);
+	}
+}
+
+
+
+
+/* Function responsible for throwing a job's result away; its rows will be queued again. */
+void editorHighlightDiscard(struct hlJob *job)
+{
+	/* Rows moved by a later insertion or deletion can only have moved past the row */
+	/* it happened at, which editorHighlightShift() already pulled "scan" back to.  */
+	if (job->start < E.hl.scan)
+		E.hl.scan = job->start;
+
+	atomic_store_explicit(&job->state, HLJOB_FREE, memory_order_release);
+}
+
+
+
+
+/* Function that tells whether a job covers rows before "start" and is still in flight. */
+int editorHighlightPendingBefore(int start)
+{
+	int k;
+
+	for (k = 0; k < KILO_HL_JOBS; k++)
+	{
+		struct hlJob *job = &E.hl.jobs[k];
+
+		if (atomic_load_explicit(&job->state, memory_order_acquire) != HLJOB_FREE &&
+			job->epoch == E.hl.epoch && job->start < start)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for installing the results of finished jobs. A job is only */
+/* installed on top of a ready previous row whose state matches the one the job   */
+/* started from, and each row only if it has not changed since it was copied.     */
+/* Returns 1 when a row on screen got its colours.                                */
+int editorHighlightCollect()
+{
+	char drain[64];
+	int redraw = 0;
+	int progress = 1;
+
+	while (read(E.hl.wakefd[0], drain, sizeof(drain)) > 0)
+		;
+
+	while (progress)
+	{
+		int k;
+
+		progress = 0;
+
+		for (k = 0; k < KILO_HL_JOBS; k++)
+		{
+			struct hlJob *job = &E.hl.jobs[k];
+
+			if (atomic_load_explicit(&job->state, memory_order_acquire) != HLJOB_DONE)
+				continue;
+
+			int s = job->start;
+
+			if (job->epoch != E.hl.epoch || job->syntax != E.syntax || s >= E.buf.numrows)
+			{
+				editorHighlightDiscard(job);
+				progress = 1;
+				continue;
+			}
+
+			if (s > 0 && !E.buf.row[s - 1].hl_ready)
+			{
+				/* Wait for the job before it, unless there is none to wait for. */
+				if (!editorHighlightPendingBefore(s))
+				{
+					editorHighlightDiscard(job);
+					progress = 1;
+				}
+
+				continue;
+			}
+
+			int in = (s > 0) ? E.buf.row[s - 1].hl_state : HL_STATE_NONE;
+
+			if (in != job->state_in)
+			{
+				editorHighlightDiscard(job);
+				progress = 1;
+				continue;
+			}
+
+			int i;
+			int last_state = HL_STATE_NONE;
+
+			for (i = 0; i < job->n && s + i < E.buf.numrows; i++)
+			{
+				erow *row = &E.buf.row[s + i];
+
+				if (row->version != job->versions[i])
+					break;
+
+				last_state = row->hl_state;
+				memcpy(row->hl, &job->hl[job->offsets[i]], row->rsize);
+				row->hl_state = job->states[i];
+				editorRowSetReady(row, 1);
+
+				if (s + i >= E.rowoff && s + i < E.rowoff + E.screenrows)
+					redraw = 1;
+			}
+
+			atomic_store_explicit(&job->state, HLJOB_FREE, memory_order_release);
+			progress = 1;
+
+			/* The row after the installed ones was highlighted from another state, or */
+			/* changed under the job: bring it in line like any edited row.           */
+			if (s + i < E.buf.numrows && i > 0 &&
+				(i < job->n || job->states[i - 1] != last_state))
+			{
+				editorUpdateSyntax(&E.buf.row[s + i]);
+				redraw = 1;
+			}
+		}
+	}
+
+	editorHighlightDispatch();
+
+	return redraw;
+}
+
+
+
+
+/* Function responsible for highlighting a freshly loaded file: small files right */
+/* away, large ones in the background so that the first frame does not wait.      */
+void editorHighlightStart()
+{
+	int j;
+
+	E.hl.defer = 0;
+
+	if (E.buf.numrows <= KILO_HL_SYNC_FILE || E.syntax == NULL)
+	{
+		for (j = 0; j < E.buf.numrows; j++)
+		{
+			int in = (j > 0) ? E.buf.row[j - 1].hl_state : HL_STATE_NONE;
+
+			/* Plain text carries no state from row to row, so attached rows can */
+			/* wait to be coloured until they are rendered.                      */
+			if (E.syntax == NULL && E.buf.row[j].render == NULL)
+				continue;
+
+			kiloRowRender(&E.buf, &E.buf.row[j]);
+
+			E.buf.row[j].hl_state = editorHighlightRow(E.syntax, E.buf.row[j].render, E.buf.row[j].rsize,
+												   E.buf.row[j].hl, in);
+			editorRowSetReady(&E.buf.row[j], 1);
+		}
+
+		return;
+	}
+
+	E.hl.scan = 0;
+	editorHighlightDispatch();
+}
+
+
+
+
+/* Function called while the editor waits for input. As long as the background */
+/* highlighter has work it waits for either a key or a finished job, installing */
+/* results and redrawing as they come in. The worker threads are started by the */
+/* first dispatch, which in a small file is once an edit leaves rows unready.   */
+void editorHighlightIdle()
+{
+	while (E.hl.unready > 0)
+	{
+		struct pollfd fds[2] = {
+			{ STDIN_FILENO, POLLIN, 0 },
+			{ E.hl.wakefd[0], POLLIN, 0 }
+		};
+
+		editorHighlightDispatch();
+
+		/* Nothing could be queued, e.g. for a file with no syntax: no one to wait for. */
+		if (E.hl.nthreads == 0)
+			return;
+
+		if (poll(fds, 2, 100) <= 0 || (fds[0].revents & POLLIN))
+			return;
+
+		if (editorHighlightCollect())
+			editorRefreshScreen();
+	}
+}
+
+
+
+
+/* Function responsible for adding "d" to entry "i" of a Fenwick tree of the folds. */
+void editorFoldAdd(long long *tree, int i, long long d)
+{
+	for (; i <= E.fold.n; i += i & -i)
+		tree[i] += d;
+}
+
+
+
+
+/* Function responsible for hiding (d = 1) or showing again (d = -1) rows [from, to], */
+/* as a range update of the two trees.                                                */
+void editorFoldRange(int from, int to, int d)
+{
+	int l = from + 1;
+	int r = to + 1;
+
+	editorFoldAdd(E.fold.b1, l, d);
+	editorFoldAdd(E.fold.b1, r + 1, -d);
+	editorFoldAdd(E.fold.b2, l, (long long) d * (l - 1));
+	editorFoldAdd(E.fold.b2, r + 1, -(long long) d * r);
+}
+
+
+
+
+/* Function responsible for building the trees again from the folded rows, once */
+/* rows have moved. A fold that now runs past the end of the file is cut short, */
+/* and folds that ended up inside another one are dropped.                      */
+void editorFoldBuild()
+{
+	struct editorFolds *f = &E.fold;
+	int n = E.buf.numrows;
+	int i, j;
+
+	if (!f->stale)
+		return;
+
+	if (n + 2 > f->cap)
+	{
+		f->cap = (n + 2) * 2;
+		f->b1 = realloc(f->b1, sizeof(long long) * f->cap);
+		f->b2 = realloc(f->b2, sizeof(long long) * f->cap);
+	}
+
+	memset(f->b1, 0, sizeof(long long) * (n + 2));
+	memset(f->b2, 0, sizeof(long long) * (n + 2));
+
+	f->n = n;
+	f->count = 0;
+	f->stale = 0;
+
+	/* Lay the hidden ranges out as differences first... */
+	for (j = 0; j < n; j++)
+	{
+		erow *row = &E.buf.row[j];
+
+		if (row->fold > n - 1 - j)
+			row->fold = n - 1 - j;
+
+		if (row->fold <= 0)
+			continue;
+
+		f->count++;
+		f->b1[j + 2]++;
+		f->b1[j + row->fold + 2]--;
+
+		for (i = j + 1; i <= j + row->fold; i++)
+			E.buf.row[i].fold = 0;
+
+		j += row->fold;
+	}
+
+	for (i = 1; i <= n; i++)
+		f->b2[i] = f->b1[i] * (i - 1);
+
+	/* ...then turn both into Fenwick trees in place, in O(n). */
+	for (i = 1; i <= n; i++)
+	{
+		int up = i + (i & -i);
+
+		if (up <= n)
+		{
+			f->b1[up] += f->b1[i];
+			f->b2[up] += f->b2[i];
+		}
+	}
+}
+
+
+
+
+/* Function that returns how many of the first "i" rows are folded away. */
+int editorFoldHiddenBefore(int i)
+{
+	long long s1 = 0, s2 = 0;
+	int k;
+
+	if (E.fold.count == 0)
+		return 0;
+
+	editorFoldBuild();
+
+	if (i > E.fold.n)
+		i = E.fold.n;
+
+	for (k = i; k > 0; k -= k & -k)
+	{
+		s1 += E.fold.b1[k];
+		s2 += E.fold.b2[k];
+	}
+
+	return s1 * i - s2;
+}
+
+
+
+
+/* Function that walks down the trees for the most rows from the top of the file */
+/* that hold fewer than "target" hidden rows, or visible ones when "hidden" is 0. */
+/* Both counts only grow down the file, so this takes O(log n).                  */
+int editorFoldSeek(int target, int hidden)
+{
+	struct editorFolds *f = &E.fold;
+	long long s1 = 0, s2 = 0;
+	int pos = 0, step = 1;
+
+	while (step * 2 <= f->n)
+		step *= 2;
+
+	for (; step > 0; step >>= 1)
+	{
+		int next = pos + step;
+
+		if (next > f->n)
+			continue;
+
+		long long t1 = s1 + f->b1[next];
+		long long t2 = s2 + f->b2[next];
+		long long h = (t1 * next) - t2;
+
+		if ((hidden ? h : next - h) < target)
+		{
+			pos = next;
+			s1 = t1;
+			s2 = t2;
+		}
+	}
+
+	return pos;
+}
+
+
+
+
+/* Functions that translate between rows of the file and their index among the */
+/* rows that are not folded away, which is what the screen shows. Both take    */
+/* O(log n); past the end of the file the two count up alike.                  */
+int editorFoldIndex(int row)
+{
+	return row - editorFoldHiddenBefore(row);
+}
+
+int editorFoldRow(int index)
+{
+	if (E.fold.count == 0)
+		return index;
+
+	editorFoldBuild();
+
+	int visible = E.fold.n - editorFoldHiddenBefore(E.fold.n);
+
+	if (index >= visible)
+		return E.fold.n + (index - visible);
+
+	return editorFoldSeek(index + 1, 0);
+}
+
+
+
+
+/* Function that tells whether a row is folded away, and the one that returns the */
+/* row a folded away row is folded under.                                         */
+int editorFoldHidden(int row)
+{
+	return E.fold.count > 0 && row < E.buf.numrows &&
+		   editorFoldHiddenBefore(row + 1) - editorFoldHiddenBefore(row) == 1;
 }
 
+int editorFoldHeader(int row)
+{
+	return editorFoldRow(editorFoldIndex(row) - 1);
+}
+
+
+
+
+/* Function responsible for folding the "n" rows after row "at" away under it. */
+/* Folds inside them are taken in: each is found by walking down the trees for */
+/* its first hidden row, so this costs O(log n) for each fold it swallows. One */
+/* that reaches past the range, like one the last row heads, grows it to its   */
+/* end, so that no row that was folded away shows up again.                    */
+void editorFoldHide(int at, int n)
+{
+	editorFoldBuild();
+
+	while (1)
+	{
+		int inner;
+
+		if (E.buf.row[at + n].fold > 0)
+			inner = at + n;
+		else if (editorFoldHiddenBefore(at + n + 1) - editorFoldHiddenBefore(at + 1) > 0)
+			inner = editorFoldSeek(editorFoldHiddenBefore(at + 1) + 1, 1) - 1;
+		else
+			break;
+
+		if (inner + E.buf.row[inner].fold - at > n)
+			n = inner + E.buf.row[inner].fold - at;
+
+		editorFoldRange(inner + 1, inner + E.buf.row[inner].fold, -1);
+		E.buf.row[inner].fold = 0;
+		E.fold.count--;
+	}
+
+	editorFoldRange(at + 1, at + n, 1);
+	E.buf.row[at].fold = n;
+	E.fold.count++;
+}
+
+
+
+
+/* Function responsible for showing the rows folded under row "at" again. */
+void editorFoldShow(int at)
+{
+	erow *row = &E.buf.row[at];
+
+	editorFoldBuild();
+
+	if (row->fold == 0)
+		return;
+
+	editorFoldRange(at + 1, at + row->fold, -1);
+
+	row->fold = 0;
+	E.fold.count--;
+}
+
+
+
+
+/* Function responsible for opening the folds headed by rows [from, to], before */
+/* an edit joins or splits them. Only the rows themselves are looked at; the    */
+/* trees are built again once the rows have moved.                             */
+void editorFoldTouch(int from, int to)
+{
+	int j;
+
+	if (E.fold.count == 0)
+		return;
+
+	for (j = from; j <= to && j < E.buf.numrows; j++)
+		if (E.buf.row[j].fold > 0)
+		{
+			E.buf.row[j].fold = 0;
+			E.fold.count--;
+			E.fold.stale = 1;
+		}
+}
+
+
+
+
+/* Function that returns the indentation of a row in columns, or -1 when it is */
+/* blank. Only its first piece is looked at, which is all of a short row.      */
+int editorFoldIndent(erow *row)
+{
+	int piece = 0, len, col = 0, j;
+	const char *s = kiloRowPiece(row, &piece, &len);
+
+	for (j = 0; s && j < len; j++)
+	{
+		if (s[j] == '\t')
+			col += KILO_TAB_STOP - (col % KILO_TAB_STOP);
+		else if (s[j] == ' ')
+			col++;
+		else
+			return col;
+	}
+
+	return -1;
+}
+
+
+
+
+/* Function that counts the fold markers, "{{{" less "}}}", in a row. */
+int editorFoldMarkers(erow *row)
+{
+	int piece = 0, len, depth = 0;
+	const char *s;
+
+	while ((s = kiloRowPiece(row, &piece, &len)) != NULL)
+	{
+		const char *p = s, *end = s + len, *m;
+
+		while ((m = memmem(p, end - p, "{{{", 3)) != NULL)
+		{
+			depth++;
+			p = m + 3;
+		}
+
+		for (p = s; (m = memmem(p, end - p, "}}}", 3)) != NULL; p = m + 3)
+			depth--;
+	}
+
+	return depth;
+}
+
+
+
+
+/* Function responsible for folding or unfolding at the cursor. A folded row is */
+/* unfolded. Otherwise the rows from the mark to the cursor are folded when the */
+/* mark is set, the rows up to the matching "}}}" when the row opens a "{{{",   */
+/* or else the rows below that are indented deeper than the cursor's row.      */
+void editorFoldToggle()
+{
+	int at = E.buf.cy;
+	int end = at;
+	int j;
+
+	if (at >= E.buf.numrows)
+		return;
+
+	editorFoldBuild();
+
+	erow *row = &E.buf.row[at];
+
+	if (row->fold > 0)
+	{
+		editorSetStatusMessage("Unfolded %d rows", row->fold);
+		editorFoldShow(at);
+		return;
+	}
+
+	if (E.mark != -1 && E.mark < E.buf.numrows && E.mark != at)
+	{
+		end = (E.mark > at) ? E.mark : at;
+		at = (E.mark > at) ? at : E.mark;
+		E.mark = -1;
+
+		/* Folds are headed by a row that is on screen. */
+		if (editorFoldHidden(at))
+			at = editorFoldHeader(at);
+	}
+
+	else if (editorFoldMarkers(row) > 0)
+	{
+		int depth = 0;
+
+		for (j = at; j < E.buf.numrows; j++)
+		{
+			depth += editorFoldMarkers(&E.buf.row[j]);
+
+			if (depth <= 0)
+				break;
+		}
+
+		end = (j < E.buf.numrows) ? j : E.buf.numrows - 1;
+	}
+
+	else
+	{
+		int indent = editorFoldIndent(row);
+
+		for (j = at + 1; indent != -1 && j < E.buf.numrows; j++)
+		{
+			int i = editorFoldIndent(&E.buf.row[j]);
+
+			if (i != -1 && i <= indent)
+				break;
+
+			if (i != -1)
+				end = j;
+		}
+	}
+
+	if (end == at)
+	{
+		editorSetStatusMessage("Nothing to fold here");
+		return;
+	}
+
+	editorFoldHide(at, end - at);
+
+	E.buf.cy = at;
+	editorSetStatusMessage("Folded %d rows", E.buf.row[at].fold);
+}
+
+
+
+
+/* Function called by the buffer before every insertion or deletion, while it still */
+/* holds the text, to keep the journal and the undo log.                            */
+void editorBufferEdit(struct kiloBuffer *b, int op, int row, int col, const char *s, int len)
+{
+	if (op == KILO_EDIT_INSERT)
+	{
+		/* A folded row that is split in two is unfolded. */
+		if (memchr(s, '\n', len))
+			editorFoldTouch(row, row);
+
+		editorJournalRecord(JOURNAL_INSERT, row, col, s, len);
+		editorUndoRecord(UNDO_INSERT, row, col, s, len);
+		return;
+	}
+
+	int endrow, endcol;
+
+	kiloTextEnd(b, row, col, len, &endrow, &endcol);
+
+	/* So are the folded rows that a deletion joins to others. */
+	if (endrow > row)
+		editorFoldTouch(row, endrow);
+
+	editorJournalRecord(JOURNAL_DELETE, row, col, NULL, len);
+
+	if (editorUndoWanted() && editorUndoFits(len))
+	{
+		editorUndoTake(UNDO_DELETE, row, col, kiloCopyText(b, row, col, endrow, endcol, len), len);
+	}
+}
+
+
+
+
+/* Functions called by the buffer when rows move, are rendered again or go away, */
+/* to keep the highlighter in step with the rows.                                */
+void editorBufferShift(struct kiloBuffer *b, int at)
+{
+	(void) b;
+
+	editorHighlightShift(at);
+	E.fold.stale = 1;
+}
+
+void editorBufferRender(struct kiloBuffer *b, erow *row)
+{
+	(void) b;
+
+	editorUpdateSyntax(row);
+}
+
+void editorBufferRelease(struct kiloBuffer *b, erow *row)
+{
+	/* Files that are not on screen keep their own count, see editorFileEvict(). */
+	if (b == &E.buf)
+		editorRowSetReady(row, 1);
+
+	if (b == &E.buf && row->fold > 0)
+		E.fold.count--;
+}
+
+struct kiloHooks editorBufferHooks =
+{
+	editorBufferEdit,
+	editorBufferShift,
+	editorBufferRender,
+	editorBufferRelease
+};
+
+
+
+
+/* Function responsible for turning one line read from disk into a row. The line is */
+/* not NULL terminated and may still carry the '\r' of a DOS line ending. "offset"  */
+/* is where the line starts in the file, or -1 when that is not known.              */
+void editorLoadLine(char *line, size_t linelen, off_t offset)
+{
+	while (linelen > 0 && line[linelen - 1] == '\r')
+		linelen--;
+
+	kiloAppendRow(&E.buf, line, linelen);
+
+	E.buf.row[E.buf.numrows - 1].offset = offset;
+	E.buf.row[E.buf.numrows - 1].origsize = linelen;
+}
+
+
+
+
+/* Function responsible for adding a piece of a line too long to be buffered to the */
+/* last row. Only the '\r's at the very end of the line are dropped, so those that  */
+/* end a piece are held back in "held" until it is known whether more text follows. */
+void editorLoadGrow(const char *s, size_t n, size_t *held)
+{
+	erow *row = &E.buf.row[E.buf.numrows - 1];
+	size_t k = n;
+
+	while (k > 0 && s[k - 1] == '\r')
+		k--;
+
+	if (k > 0)
+	{
+		char cr[64];
+		memset(cr, '\r', sizeof(cr));
+
+		while (*held > 0)
+		{
+			size_t m = (*held < sizeof(cr)) ? *held : sizeof(cr);
+
+			kiloRowAppend(&E.buf, row, cr, m);
+			*held -= m;
+		}
+
+		kiloRowAppend(&E.buf, row, s, k);
+	}
+
+	*held += n - k;
+}
+
+
+
+
+/* Function responsible for remembering which version of the file is on disk. */
+void editorStatDisk()
+{
+	struct stat st;
+
+	if (E.filename == NULL || stat(E.filename, &st) == -1)
+	{
+		E.disk_size = -1;
+		E.disk_mtime = -1;
+		return;
+	}
+
+	E.disk_size = st.st_size;
+	E.disk_mtime = (st.st_mtim.tv_sec * 1000000000LL) + st.st_mtim.tv_nsec;
+}
+
+
+
+
+/* Function responsible for marking every row as matching the file on disk, after */
+/* a load or a full save. Row offsets are only meaningful for uncompressed files. */
+void editorRowsSynced()
+{
+	off_t offset = 0;
+	int j;
+
+	for (j = 0; j < E.buf.numrows; j++)
+	{
+		E.buf.row[j].offset = E.gzip ? -1 : offset;
+		E.buf.row[j].origsize = E.buf.row[j].size;
+		E.buf.row[j].dirty = 0;
+
+		offset += E.buf.row[j].size + 1;
+	}
+
+	E.buf.ndirty = 0;
+	E.buf.layout_changed = 0;
+	editorStatDisk();
+}
+
+
+
+
+/* Function responsible for handling file I/O. Plain and gzip-compressed files are   */
+/* both read in fixed size chunks and split into rows as they arrive, so that a      */
+/* compressed file never exists decompressed anywhere but in the rows themselves.    */
+void editorOpen(char *filename)
+{
+	/* Make a copy of the string containing the file's name. */
+	free(E.filename);
+	E.filename = strdup(filename);
+	editorSelectSyntaxHighlight();
+
+	/* Rows are highlighted once the whole file is in, see editorHighlightStart(). */
+	E.hl.defer = 1;
+
+	/* Binary files are shown in the hex view instead of being split into rows */
+	/* at whatever newline bytes they happen to hold.                         */
+	if (editorHexOpen(filename) == 0)
+		goto loaded;
+
+	/* With a session server running, the index it keeps is used instead. */
+	if (editorAttach(filename) == 0)
+		goto loaded;
+
+	/* Open the file specified and check incase there is none. */
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		terminate("open");
+
+	/* Peek at the first two bytes of the file for the gzip magic number. */
+	unsigned char magic[2];
+	E.gzip = (pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+
+	gzFile gz = NULL;
+	if (E.gzip)
+	{
+		/* From here on zlib owns the file descriptor. */
+		if ((gz = gzdopen(fd, "rb")) == NULL)
+			terminate("gzdopen");
+
+		gzbuffer(gz, KILO_READ_CHUNK);
+	}
+
+	char *chunk = malloc(KILO_READ_CHUNK);
+	/* "line" only holds the lines that straddle two chunks; every other line is */
+	/* handed to editorLoadLine() straight out of the chunk.                     */
+	char *line = NULL;
+	size_t linelen = 0;
+	size_t linecap = 0;
+	/* File offsets of the start of the current chunk and of the current line. */
+	off_t base = 0;
+	off_t linestart = 0;
+	/* Set while a line too long to be buffered is being read straight into its row, */
+	/* with the '\r's that may yet turn out to end it held back.                    */
+	int growing = 0;
+	size_t held = 0;
+	int drawn = 0;
+	time_t last_draw = time(NULL);
+
+	while (1)
+	{
+		ssize_t nread = E.gzip ? gzread(gz, chunk, KILO_READ_CHUNK)
+							   : read(fd, chunk, KILO_READ_CHUNK);
+		if (nread == -1)
+			terminate(E.gzip ? "gzread" : "read");
+		if (nread == 0)
+			break;
+
+		char *p = chunk;
+		char *end = chunk + nread;
+
+		while (p < end)
+		{
+			char *nl = memchr(p, '\n', end - p);
+			size_t n = (nl ? nl : end) - p;
+
+			if (growing)
+				editorLoadGrow(p, n, &held);
+
+			else if (nl && linelen == 0)
+				editorLoadLine(p, n, E.gzip ? -1 : linestart);
+
+			else if (linelen + n > KILO_LONG_ROW)
+			{
+				/* A line this long becomes a row right away; the rest of it is added */
+				/* to the row as it arrives rather than piling up in "line".         */
+				editorLoadLine(line, 0, E.gzip ? -1 : linestart);
+				editorLoadGrow(line, linelen, &held);
+				editorLoadGrow(p, n, &held);
+				linelen = 0;
+				growing = 1;
+			}
+
+			else
+			{
+				if (linelen + n > linecap)
+				{
+					linecap = (linelen + n) * 2;
+					line = realloc(line, linecap);
+				}
+
+				memcpy(&line[linelen], p, n);
+				linelen += n;
+
+				if (nl)
+				{
+					editorLoadLine(line, linelen, E.gzip ? -1 : linestart);
+					linelen = 0;
+				}
+			}
+
+			if (nl && growing)
+			{
+				E.buf.row[E.buf.numrows - 1].origsize = E.buf.row[E.buf.numrows - 1].size;
+				growing = 0;
+				held = 0;
+			}
+
+			p += n + (nl != NULL);
+
+			if (nl)
+				linestart = base + (p - chunk);
+		}
+
+		base += nread;
+
+		/* Loading is progressive: the first screenful is shown as soon as it has been */
+		/* read, and the row count on the status bar is refreshed every second.       */
+		if ((!drawn && E.buf.numrows >= E.screenrows) || time(NULL) != last_draw)
+		{
+			editorSetStatusMessage("Loading %.20s... %d lines", E.filename, E.buf.numrows);
+			editorRefreshScreen();
+			drawn = 1;
+			last_draw = time(NULL);
+		}
+	}
+
+	/* The last line of the file may not end in a newline. */
+	if (growing)
+		E.buf.row[E.buf.numrows - 1].origsize = E.buf.row[E.buf.numrows - 1].size;
+
+	else if (linelen)
+		editorLoadLine(line, linelen, E.gzip ? -1 : linestart);
+
+	free(line);
+	free(chunk);
+
+	if (E.gzip)
+		gzclose(gz);
+	else
+		close(fd);
+
+loaded:
+	editorHighlightStart();
+
+	/* The rows now line up with the file, offsets and all. */
+	E.buf.ndirty = 0;
+	E.buf.layout_changed = 0;
+	editorStatDisk();
+}
+
+
+
+
+/* Function responsible for streaming the rows to disk through zlib, one row at a */
+/* time, so that saving a compressed file never builds a copy of the whole text.   */
+/* Returns the number of uncompressed bytes written or -1 on error.               */
+long long editorSaveGzip(int fd)
+{
+	/* Write a gzip stream on a duplicate, since gzclose() closes what it is given. */
+	gzFile gz = gzdopen(dup(fd), "wb");
+	if (gz == NULL)
+		return -1;
+
+	gzbuffer(gz, KILO_READ_CHUNK);
+
+	long long len = 0;
+	int j;
+
+	for (j = 0; j < E.buf.numrows; j++)
+	{
+		const char *s;
+		int piece = 0;
+		int n;
+
+		/* Long rows are written a chunk at a time. */
+		while ((s = kiloRowPiece(&E.buf.row[j], &piece, &n)) != NULL)
+			if (n && gzwrite(gz, s, n) != n)
+				break;
+
+		if (s != NULL || gzputc(gz, '\n') == -1)
+			break;
+
+		len += E.buf.row[j].size + 1;
+	}
+
+	/* gzclose() flushes the stream, so its result matters as much as the writes'. */
+	if (gzclose(gz) != Z_OK || j != E.buf.numrows)
+		return -1;
+
+	return len;
+}
+
+
+
+
+/* Function responsible for saving only the rows that were edited, in place. This */
+/* is possible as long as no row was added or removed, every edited row kept its  */
+/* length and nobody else changed the file since we read it. Returns the number   */
+/* of bytes written, -1 on error or -2 when a full save is needed instead.        */
+long long editorSaveDelta()
+{
+	if (E.gzip || E.buf.layout_changed)
+		return -2;
+
+	int j;
+
+	for (j = 0; j < E.buf.ndirty; j++)
+	{
+		erow *row = &E.buf.row[E.buf.dirtyrows[j]];
+
+		if (row->offset == -1 || row->size != row->origsize)
+			return -2;
+	}
+
+	struct stat st;
+	if (stat(E.filename, &st) == -1 || st.st_size != E.disk_size ||
+		(st.st_mtim.tv_sec * 1000000000LL) + st.st_mtim.tv_nsec != E.disk_mtime)
+		return -2;
+
+	int fd = open(E.filename, O_WRONLY);
+	if (fd == -1)
+		return -1;
+
+	long long len = 0;
+
+	for (j = 0; j < E.buf.ndirty; j++)
+	{
+		erow *row = &E.buf.row[E.buf.dirtyrows[j]];
+		off_t offset = row->offset;
+		const char *s;
+		int piece = 0;
+		int n;
+
+		while ((s = kiloRowPiece(row, &piece, &n)) != NULL)
+		{
+			if (pwrite(fd, s, n, offset) != n)
+			{
+				close(fd);
+				return -1;
+			}
+
+			offset += n;
+		}
+
+		row->dirty = 0;
+		len += row->size;
+	}
+
+	if (fsync(fd) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	E.buf.ndirty = 0;
+	editorStatDisk();
+
+	return len;
+}
+
+
+
+
+/* Function responsible for writing all "len" bytes of "s", carrying on after the */
+/* short writes that a signal or a full pipe can cause. Returns 0 or -1 on error. */
+int editorWriteAll(int fd, const char *s, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, s, len);
+
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return -1;
+
+		s += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for adding "n" bytes to "buf", the KILO_READ_CHUNK bytes */
+/* that a save writes through, writing them out each time it fills up. Returns 0 */
+/* or -1 on error.                                                               */
+int editorSaveBuffered(int fd, char *buf, size_t *used, const char *s, size_t n)
+{
+	while (n > 0)
+	{
+		size_t take = KILO_READ_CHUNK - *used;
+
+		if (take > n)
+			take = n;
+
+		memcpy(&buf[*used], s, take);
+		*used += take;
+		s += take;
+		n -= take;
+
+		if (*used == KILO_READ_CHUNK)
+		{
+			if (editorWriteAll(fd, buf, *used) == -1)
+				return -1;
+
+			*used = 0;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for rewriting the whole file. The new contents are written */
+/* to a temporary file next to it which then replaces it with rename(), so that a  */
+/* crash halfway through a save never leaves a truncated file behind. The rows are */
+/* written out through a fixed size buffer rather than joined in memory first, so  */
+/* saving takes no more memory for a file of any size. Returns the number of bytes */
+/* written or -1 on error.                                                         */
+long long editorSaveFull()
+{
+	int pathlen = strlen(E.filename) + sizeof(".XXXXXX");
+	char *tmp = malloc(pathlen);
+	snprintf(tmp, pathlen, "%s.XXXXXX", E.filename);
+
+	int fd = mkstemp(tmp);
+	if (fd == -1)
+	{
+		free(tmp);
+		return -1;
+	}
+
+	/* Keep the permissions of the file being replaced. */
+	struct stat st;
+	fchmod(fd, (stat(E.filename, &st) == 0) ? (st.st_mode & 07777) : 0644);
+
+	long long len;
+
+	if (E.gzip)
+		len = editorSaveGzip(fd);
+
+	else
+	{
+		char *buf = malloc(KILO_READ_CHUNK);
+		size_t used = 0;
+		int j;
+
+		editorMemAdjust(&E.mem.transient, 0, kiloMemSize(buf));
+		len = 0;
+
+		for (j = 0; j < E.buf.numrows; j++)
+		{
+			const char *s;
+			int piece = 0;
+			int n;
+
+			/* Long rows are written a chunk at a time. */
+			while ((s = kiloRowPiece(&E.buf.row[j], &piece, &n)) != NULL)
+				if (editorSaveBuffered(fd, buf, &used, s, n) == -1)
+					break;
+
+			if (s != NULL || editorSaveBuffered(fd, buf, &used, "\n", 1) == -1)
+				break;
+
+			len += E.buf.row[j].size + 1;
+		}
+
+		if (j != E.buf.numrows || editorWriteAll(fd, buf, used) == -1)
+			len = -1;
+
+		editorMemAdjust(&E.mem.transient, kiloMemSize(buf), 0);
+		free(buf);
+	}
+
+	if (len != -1 && fsync(fd) == -1)
+		len = -1;
+
+	/* close() gives the descriptor up even when it fails, so it is closed once only. */
+	if (close(fd) == -1)
+		len = -1;
+
+	if (len == -1 || rename(tmp, E.filename) == -1)
+	{
+		int saved = errno;
+
+		unlink(tmp);
+		free(tmp);
+
+		errno = saved;
+		return -1;
+	}
+
+	free(tmp);
+
+	editorRowsSynced();
+
+	return len;
+}
+
+
+
+
+/* Function that is responsible for writing to disk. */
+void editorSave()
+{
+	/* Check if the file being written is a newfile. */
+	if (E.filename == NULL) 
+		return;
+
+	long long len = editorSaveDelta();
+	int delta = (len != -2);
+
+	if (!delta)
+		len = editorSaveFull();
+
+	if (len == -1)
+	{
+		editorSetStatusMessage("Can't save ! I/O error: %s", strerror(errno));
+		return;
+	}
+
+	editorJournalReset();
+
+	if (delta)
+		editorSetStatusMessage("%lld bytes written to disk in place", len);
+	else
+		editorSetStatusMessage("%lld bytes written to disk%s", len, E.gzip ? " (gzip)" : "");
+}
+
+
+
+
+/* Function that returns the path of the session server's socket: KILO_SOCKET if  */
+/* set, or kilo.sock in the user's runtime directory, or in a directory of the     */
+/* user's own in /tmp. That one is created if need be, and only used if it is a   */
+/* directory that belongs to the user and nobody else can get into. Returns 0, or */
+/* -1 with errno set.                                                             */
+int editorSocketPath(char *path, size_t size)
+{
+	char *env = getenv("KILO_SOCKET");
+	char *dir = getenv("XDG_RUNTIME_DIR");
+	char tmpdir[64];
+	struct stat st;
+
+	if (env && *env)
+	{
+		snprintf(path, size, "%s", env);
+		return 0;
+	}
+
+	if (dir && *dir)
+	{
+		snprintf(path, size, "%s/kilo.sock", dir);
+		return 0;
+	}
+
+	snprintf(tmpdir, sizeof(tmpdir), "/tmp/kilo-%d", (int) getuid());
+
+	if (mkdir(tmpdir, 0700) == -1 && errno != EEXIST)
+		return -1;
+
+	if (lstat(tmpdir, &st) == -1)
+		return -1;
+
+	if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0)
+	{
+		errno = EACCES;
+		return -1;
+	}
+
+	snprintf(path, size, "%s/kilo.sock", tmpdir);
+	return 0;
+}
+
+
+
+
+/* Function responsible for building the index of a file in a sealed memfd: the */
+/* header, the text as it is loaded (gzip files decompressed) and where every   */
+/* line starts. Returns the memfd, or -1 with errno set.                        */
+int editorServerBuild(const char *path, struct stat *st)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, st) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	int mfd = memfd_create("kilo-index", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (mfd == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	struct serverIndex hdr;
+	unsigned char magic[2];
+	gzFile gz = NULL;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, KILO_SERVER_MAGIC, sizeof(hdr.magic));
+	hdr.gzip = (pread(fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b);
+	hdr.mtime = (st->st_mtim.tv_sec * 1000000000LL) + st->st_mtim.tv_nsec;
+	hdr.disk_size = st->st_size;
+	hdr.text = sizeof(hdr);
+
+	if (hdr.gzip)
+	{
+		if ((gz = gzdopen(fd, "rb")) == NULL)
+			goto fail;
+
+		gzbuffer(gz, KILO_READ_CHUNK);
+	}
+
+	char *chunk = malloc(KILO_READ_CHUNK);
+	long long *starts = malloc(sizeof(long long) * 1024);
+	long long ncap = 1024;
+	long long n = 0;
+	ssize_t nread = (pwrite(mfd, &hdr, sizeof(hdr), 0) == sizeof(hdr)) ? 1 : -1;
+
+	starts[n++] = 0;
+
+	while (nread > 0 && (nread = hdr.gzip ? gzread(gz, chunk, KILO_READ_CHUNK)
+										  : read(fd, chunk, KILO_READ_CHUNK)) > 0)
+	{
+		char *p = chunk;
+		char *end = chunk + nread;
+		char *nl;
+
+		if (pwrite(mfd, chunk, nread, hdr.text + hdr.size) != nread)
+		{
+			nread = -1;
+			break;
+		}
+
+		while ((nl = memchr(p, '\n', end - p)) != NULL)
+		{
+			if (n == ncap)
+			{
+				ncap *= 2;
+				starts = realloc(starts, sizeof(long long) * ncap);
+			}
+
+			starts[n++] = hdr.size + (nl + 1 - chunk);
+			p = nl + 1;
+		}
+
+		hdr.size += nread;
+	}
+
+	/* The line table holds where each line starts and, as the last entry, one */
+	/* past the end of the text. A last line without a newline is a row too.   */
+	if (nread == 0)
+	{
+		hdr.nrows = n - 1;
+
+		if (starts[n - 1] < hdr.size)
+		{
+			if (n == ncap)
+				starts = realloc(starts, sizeof(long long) * (++ncap));
+
+			starts[n++] = hdr.size + 1;
+			hdr.nrows++;
+		}
+
+		hdr.lines = (hdr.text + hdr.size + 7) & ~7LL;
+
+		if (pwrite(mfd, starts, sizeof(long long) * n, hdr.lines) != (ssize_t) (sizeof(long long) * n) ||
+			pwrite(mfd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			nread = -1;
+	}
+
+	free(chunk);
+	free(starts);
+
+	if (hdr.gzip)
+		gzclose(gz);
+	else
+		close(fd);
+
+	/* Clients map the index read-only; sealing it means none of them can be */
+	/* pulled out from under by another.                                     */
+	if (nread == 0 && fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0)
+		return mfd;
+
+	close(mfd);
+	return -1;
+
+fail:
+	close(fd);
+	close(mfd);
+	return -1;
+}
+
+
+
+
+/* Function responsible for answering one client: it names a file, and gets the */
+/* index of the file back, built now unless a current one is kept already.      */
+void editorServerClient(struct serverEntry **cache, int *ncache, int c)
+{
+	struct ucred cred;
+	socklen_t credlen = sizeof(cred);
+	char path[PATH_MAX + 1];
+	int len = 0;
+
+	/* Only the user running the server gets at the files it has loaded. */
+	if (getsockopt(c, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) == -1 || cred.uid != getuid())
+		return;
+
+	/* Clients are answered one at a time, so one that does not name its file in */
+	/* time is dropped rather than keep all the others waiting.                  */
+	long long deadline = editorNanos() + (KILO_SERVER_TIMEOUT_MS * 1000000LL);
+
+	while (1)
+	{
+		struct pollfd pfd = { c, POLLIN, 0 };
+		long long left = (deadline - editorNanos()) / 1000000;
+
+		if (len == PATH_MAX || left <= 0 || poll(&pfd, 1, left) <= 0 || read(c, &path[len], 1) != 1)
+			return;
+
+		if (path[len] == '\n')
+			break;
+
+		len++;
+	}
+
+	path[len] = '\0';
+
+	struct serverReply reply = { 0, 0 };
+	struct serverEntry *e = NULL;
+	struct stat st;
+	int k;
+
+	for (k = 0; k < *ncache; k++)
+		if (!strcmp((*cache)[k].path, path))
+			e = &(*cache)[k];
+
+	/* An index is only handed out for the very file that is on disk now. */
+	if (e && e->fd != -1 && (stat(path, &st) == -1 || st.st_dev != e->dev || st.st_ino != e->ino ||
+			  st.st_size != e->size || (st.st_mtim.tv_sec * 1000000000LL) + st.st_mtim.tv_nsec != e->mtime))
+	{
+		close(e->fd);
+		e->fd = -1;
+	}
+
+	if (e == NULL)
+	{
+		*cache = realloc(*cache, sizeof(struct serverEntry) * (*ncache + 1));
+		e = &(*cache)[(*ncache)++];
+		e->path = strdup(path);
+		e->fd = -1;
+	}
+
+	/* The version of the file is only known, and kept, once an index was built. */
+	if (e->fd == -1 && (e->fd = editorServerBuild(path, &st)) != -1)
+	{
+		e->dev = st.st_dev;
+		e->ino = st.st_ino;
+		e->size = st.st_size;
+		e->mtime = (st.st_mtim.tv_sec * 1000000000LL) + st.st_mtim.tv_nsec;
+	}
+
+	if (e->fd == -1)
+	{
+		reply.status = -1;
+		reply.err = errno;
+	}
+
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { &reply, sizeof(reply) };
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (e->fd != -1)
+	{
+		struct cmsghdr *cmsg;
+
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &e->fd, sizeof(int));
+	}
+
+	sendmsg(c, &msg, MSG_NOSIGNAL);
+}
+
+
+
+
+/* Function that runs the session server ("kilo --server"). It keeps the index */
+/* of every file asked for in shared memory and hands it to any later kilo     */
+/* that opens the same file, which then starts without reading it. Clients    */
+/* are answered one at a time; it runs until it is killed.                     */
+int editorServe()
+{
+	struct sockaddr_un addr;
+	struct serverEntry *cache = NULL;
+	int ncache = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (editorSocketPath(addr.sun_path, sizeof(addr.sun_path)) == -1)
+	{
+		perror("kilo: socket directory");
+		return 1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		perror("socket");
+		return 1;
+	}
+
+	/* A socket left behind by a server that is gone is replaced; one that a */
+	/* server still answers on is left to it.                               */
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+	{
+		fprintf(stderr, "kilo: a server is already running on %s\n", addr.sun_path);
+		return 1;
+	}
+
+	if (errno != ECONNREFUSED && errno != ENOENT)
+	{
+		perror(addr.sun_path);
+		return 1;
+	}
+
+	unlink(addr.sun_path);
+	umask(077);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 16) == -1)
+	{
+		perror(addr.sun_path);
+		return 1;
+	}
+
+	printf("kilo: serving on %s\n", addr.sun_path);
+	fflush(stdout);
+
+	while (1)
+	{
+		int c = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+		if (c == -1)
+			continue;
+
+		editorServerClient(&cache, &ncache, c);
+		close(c);
+	}
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for attaching to the index a session server keeps of a */
+/* file, as a much faster editorOpen(): the rows point into the shared index   */
+/* and are only rendered once they are needed. Returns -1, having touched      */
+/* nothing, when there is no server or it cannot serve the file.              */
+int editorAttach(const char *filename)
+{
+	struct sockaddr_un addr;
+	char *path = realpath(filename, NULL);
+
+	if (path == NULL)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	struct ucred cred;
+	socklen_t credlen = sizeof(cred);
+	int fd = -1;
+
+	/* The server has to be the user's own, or it could hand back any text at all. */
+	if (editorSocketPath(addr.sun_path, sizeof(addr.sun_path)) == -1 ||
+		(fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ||
+		connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+		getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) == -1 || cred.uid != getuid())
+	{
+		if (fd != -1)
+			close(fd);
+
+		free(path);
+		return -1;
+	}
+
+	int len = strlen(path);
+	path[len] = '\n';
+
+	struct serverReply reply = { -1, 0 };
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { &reply, sizeof(reply) };
+	struct msghdr msg;
+	int mfd = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (write(fd, path, len + 1) == len + 1 && recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) == sizeof(reply) &&
+		reply.status == 0)
+	{
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&mfd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	close(fd);
+	free(path);
+
+	struct stat st;
+	char *map = MAP_FAILED;
+
+	if (mfd != -1 && fstat(mfd, &st) == 0 && st.st_size >= (off_t) sizeof(struct serverIndex))
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, mfd, 0);
+
+	if (mfd != -1)
+		close(mfd);
+
+	if (map == MAP_FAILED)
+		return -1;
+
+	struct serverIndex *hdr = (struct serverIndex *) map;
+	const long long *starts = NULL;
+	struct stat disk;
+	long long j;
+
+	/* An index of an older version of the file would pair its rows and offsets */
+	/* with the size and mtime of the new one, and a delta save would then write */
+	/* them at the wrong places: the file is read instead.                      */
+	if (stat(filename, &disk) == -1 || disk.st_size != hdr->disk_size ||
+		(disk.st_mtim.tv_sec * 1000000000LL) + disk.st_mtim.tv_nsec != hdr->mtime)
+	{
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	/* The line table has to be the nrows + 1 entries that end the index, after */
+	/* the text; the terms are checked one by one so that none can overflow.    */
+	if (memcmp(hdr->magic, KILO_SERVER_MAGIC, sizeof(hdr->magic)) == 0 &&
+		hdr->text >= (long long) sizeof(*hdr) && hdr->size >= 0 && hdr->size <= st.st_size - hdr->text &&
+		hdr->lines >= hdr->text + hdr->size && (hdr->lines % sizeof(long long)) == 0 &&
+		hdr->nrows >= 0 && hdr->nrows < (st.st_size - hdr->lines) / (long long) sizeof(long long) &&
+		hdr->lines + (hdr->nrows + 1) * (long long) sizeof(long long) == st.st_size)
+		starts = (const long long *) &map[hdr->lines];
+
+	/* Every line starts where the one before ended, past its newline, and the */
+	/* last entry is at most one past the end of the text.                    */
+	for (j = 0; starts && j < hdr->nrows; j++)
+		if (starts[j] < 0 || starts[j + 1] <= starts[j])
+			starts = NULL;
+
+	if (starts == NULL || starts[hdr->nrows] > hdr->size + 1)
+	{
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	const char *text = &map[hdr->text];
+
+	E.gzip = hdr->gzip;
+	E.shared = map;
+	E.shared_len = st.st_size;
+
+	for (j = 0; j < hdr->nrows; j++)
+	{
+		long long start = starts[j];
+		long long linelen = starts[j + 1] - start - 1;
+
+		while (linelen > 0 && text[start + linelen - 1] == '\r')
+			linelen--;
+
+		if (linelen > KILO_LONG_ROW)
+			kiloAppendRow(&E.buf, &text[start], linelen);
+		else
+			kiloAppendShared(&E.buf, &text[start], linelen);
+
+		erow *row = &E.buf.row[E.buf.numrows - 1];
+
+		row->offset = E.gzip ? -1 : start;
+		row->origsize = linelen;
+
+		/* Rows are highlighted in order by the background highlighter, which */
+		/* renders them as it goes.                                           */
+		if (E.syntax)
+			editorRowSetReady(row, 0);
+	}
+
+	return 0;
+}
+
+
+
+
+/* Function that returns a monotonic timestamp in milliseconds. */
+long long editorMillis()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000LL) + (ts.tv_nsec / 1000000);
+}
+
+
+
+
+/* Function responsible for filling in the journal header for the file the rows were */
+/* loaded from. The size and mtime are those recorded at load or save time, not a    */
+/* fresh stat(), so that a file changed by someone else since then does not match.   */
+int editorJournalStat(struct journalHeader *hdr)
+{
+	if (E.filename == NULL || E.disk_size == -1)
+		return -1;
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, KILO_JOURNAL_MAGIC, sizeof(hdr->magic));
+	hdr->size = E.disk_size;
+	hdr->mtime = E.disk_mtime;
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for setting up the path of the journal kept next to the file. */
+void editorJournalInit()
+{
+	free(E.journal.path);
+	E.journal.path = NULL;
+
+	if (E.filename == NULL)
+		return;
+
+	int len = strlen(E.filename) + sizeof(".kjournal");
+	E.journal.path = malloc(len);
+	snprintf(E.journal.path, len, "%s.kjournal", E.filename);
+	E.journal.last_sync = editorMillis();
+}
+
+
+
+
+/* Function responsible for writing out and fsync'ing the pending journal records. */
+/* The journal file itself is only created once there is something to put in it.  */
+void editorJournalFlush()
+{
+	struct editorJournal *j = &E.journal;
+
+	if (j->len == 0 || j->path == NULL)
+		return;
+
+	if (j->fd == -1)
+	{
+		struct journalHeader hdr;
+
+		if (editorJournalStat(&hdr) == -1)
+			return;
+
+		j->fd = open(j->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (j->fd == -1)
+			return;
+
+		if (write(j->fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+			goto fail;
+	}
+
+	if (write(j->fd, j->buf, j->len) != j->len || fdatasync(j->fd) == -1)
+		goto fail;
+
+	j->len = 0;
+	j->last = -1;
+	j->last_sync = editorMillis();
+	return;
+
+fail:
+	/* Give up on journaling rather than keep a journal with holes in it. */
+	editorSetStatusMessage("Journal disabled ! I/O error: %s", strerror(errno));
+	close(j->fd);
+	j->fd = -1;
+	free(j->path);
+	j->path = NULL;
+}
+
+
+
+
+/* Function responsible for appending an edit to the journal. Consecutive inserts */
+/* are merged into a single record while they have not been flushed. Deletions   */
+/* only record how many bytes went, so "s" is only read for insertions.           */
+void editorJournalRecord(int op, int row, int col, const char *s, int len)
+{
+	struct editorJournal *j = &E.journal;
+
+	if (j->replaying || j->path == NULL)
+		return;
+
+	int textlen = (op == JOURNAL_INSERT) ? len : 0;
+
+	/* Records sit at unaligned offsets in the buffer, so they are copied in and out. */
+	struct journalRecord last;
+	int merge = 0;
+
+	if (j->last != -1)
+	{
+		memcpy(&last, &j->buf[j->last], sizeof(last));
+		merge = (op == JOURNAL_INSERT && last.op == JOURNAL_INSERT &&
+				 last.row == row && last.col + last.len == col);
+	}
+
+	int need = j->len + textlen + (merge ? 0 : sizeof(struct journalRecord));
+	if (need > j->cap)
+	{
+		j->cap = need * 2;
+		j->buf = realloc(j->buf, j->cap);
+	}
+
+	if (merge)
+	{
+		last.len += len;
+		memcpy(&j->buf[j->last], &last, sizeof(last));
+	}
+
+	else
+	{
+		struct journalRecord rec = { op, row, col, len };
+
+		j->last = j->len;
+		memcpy(&j->buf[j->len], &rec, sizeof(rec));
+		j->len += sizeof(rec);
+	}
+
+	memcpy(&j->buf[j->len], s, textlen);
+	j->len += textlen;
+
+	j->last_edit = editorMillis();
+
+	/* Bound how much can be lost while the user types without pausing. */
+	if (j->last_edit - j->last_sync >= KILO_JOURNAL_MAX_MS || j->len >= KILO_JOURNAL_MAX_BYTES)
+		editorJournalFlush();
+}
+
+
+
+
+/* Function called while the editor waits for input; flushes the journal in batches. */
+void editorJournalIdle()
+{
+	if (E.journal.len && editorMillis() - E.journal.last_edit >= KILO_JOURNAL_IDLE_MS)
+		editorJournalFlush();
+}
+
+
+
+
+/* Function responsible for discarding the journal once the file has been saved, or */
+/* when the editor is quit on purpose.                                              */
+void editorJournalReset()
+{
+	editorJournalDiscard(&E.journal);
+}
+
+
+
+
+/* Function responsible for closing and removing the journal "j". */
+void editorJournalDiscard(struct editorJournal *j)
+{
+	if (j->fd != -1)
+		close(j->fd);
+
+	j->fd = -1;
+	j->len = 0;
+	j->last = -1;
+
+	if (j->path)
+		unlink(j->path);
+}
+
+
+
+
+/* Function responsible for replaying a journal left behind by a crashed session. */
+/* The journal is only trusted if the file has not changed since it was started.  */
+void editorJournalRecover()
+{
+	struct editorJournal *j = &E.journal;
+
+	if (j->path == NULL)
+		return;
+
+	FILE *fp = fopen(j->path, "r");
+	if (!fp)
+		return;
+
+	struct journalHeader hdr, cur;
+	struct journalRecord rec;
+	struct stat st;
+	char *text = NULL;
+	int nrec = 0;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || editorJournalStat(&cur) == -1 ||
+		memcmp(&hdr, &cur, sizeof(hdr)) != 0 || fstat(fileno(fp), &st) == -1)
+	{
+		fclose(fp);
+		editorSetStatusMessage("Ignoring stale journal %.40s", j->path);
+		return;
+	}
+
+	/* Where the last record that was read whole ends. */
+	long good = ftell(fp);
+
+	j->replaying = 1;
+
+	/* Replayed edits are rendered and highlighted once, when all are in. */
+	kiloBeginBatch(&E.buf);
+
+	/* A record cut short by the crash is simply where the replay stops. */
+	while (fread(&rec, sizeof(rec), 1, fp) == 1)
+	{
+		if (rec.len < 0 || rec.row < 0 || rec.row > E.buf.numrows)
+			break;
+
+		if (rec.op == JOURNAL_INSERT)
+		{
+			char *grown;
+
+			/* A garbled length is caught before it turns into a huge allocation. */
+			if (rec.len > st.st_size - ftell(fp) || (grown = realloc(text, rec.len + 1)) == NULL)
+				break;
+
+			text = grown;
+			if (fread(text, 1, rec.len, fp) != (size_t) rec.len)
+				break;
+
+			kiloInsertText(&E.buf, rec.row, rec.col, text, rec.len, NULL, NULL);
+		}
+
+		else if (rec.op == JOURNAL_DELETE)
+			kiloDeleteText(&E.buf, rec.row, rec.col, rec.len);
+
+		else
+			break;
+
+		good = ftell(fp);
+		nrec++;
+	}
+
+	kiloEndBatch(&E.buf);
+
+	j->replaying = 0;
+	free(text);
+	fclose(fp);
+
+	E.buf.cx = 0;
+	E.buf.cy = 0;
+
+	/* Keep appending to the recovered journal until the file is saved, from the */
+	/* end of the last good record: what follows it could never be replayed, and */
+	/* would hide every record appended behind it from the next recovery.       */
+	j->fd = open(j->path, O_WRONLY | O_APPEND);
+
+	if (j->fd != -1 && ftruncate(j->fd, good) == -1)
+	{
+		close(j->fd);
+		j->fd = -1;
+	}
+
+	j->last_sync = editorMillis();
+
+	editorSetStatusMessage("Recovered %d edits from %.40s", nrec, j->path);
+}
+
+
+
+
+/* Function responsible for releasing the undo entries from index "from" on. */
+void editorUndoDrop(int from)
+{
+	struct editorUndo *u = &E.undo;
+	int j;
+
+	if (from < u->n)
+		u->endrow = -1;
+
+	for (j = from; j < u->n; j++)
+	{
+		u->bytes -= sizeof(struct undoEntry) + u->entries[j].len;
+		free(u->entries[j].text);
+	}
+
+	u->n = from;
+	if (u->pos > from)
+		u->pos = from;
+}
+
+
+
+
+/* Function responsible for keeping the undo log under its memory limit by    */
+/* forgetting the oldest groups of entries. An entry bigger than the limit on */
+/* its own empties the log.                                                   */
+void editorUndoTrim()
+{
+	struct editorUndo *u = &E.undo;
+	int drop = 0;
+	size_t bytes = u->bytes;
+
+	while (drop < u->n && bytes > u->limit)
+	{
+		int group = u->entries[drop].group;
+
+		/* Never split a group; a half undone bulk edit is worse than none. The */
+		/* rest of a batch that is still open would only be half of one too.    */
+		if (u->batch && group == u->group)
+			u->lost = group;
+
+		while (drop < u->n && u->entries[drop].group == group)
+		{
+			bytes -= sizeof(struct undoEntry) + u->entries[drop].len;
+			free(u->entries[drop].text);
+			drop++;
+		}
+	}
+
+	if (drop == 0)
+		return;
+
+	memmove(u->entries, &u->entries[drop], sizeof(struct undoEntry) * (u->n - drop));
+	u->n -= drop;
+	u->pos -= drop;
+	u->bytes = bytes;
+
+	if (u->pos < 0)
+		u->pos = 0;
+}
+
+
+
+
+/* Function that tells whether edits are being recorded in the undo log right now. */
+int editorUndoWanted()
+{
+	return !E.undo.applying && !E.journal.replaying && !(E.undo.batch && E.undo.lost == E.undo.group);
+}
+
+
+
+
+/* Function that tells whether an edit of "len" bytes fits in the undo log, */
+/* before its text is copied. One that does not empties the log instead.    */
+int editorUndoFits(int len)
+{
+	struct editorUndo *u = &E.undo;
+
+	if (sizeof(struct undoEntry) + len <= u->limit)
+		return 1;
+
+	editorUndoDrop(0);
+
+	if (u->batch)
+		u->lost = u->group;
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for adding an entry to the undo log, taking ownership of */
+/* "text". Keystrokes that continue the previous entry are merged into it.       */
+void editorUndoTake(int op, int row, int col, char *text, int len)
+{
+	struct editorUndo *u = &E.undo;
+	int endrow = -1, endcol = -1;
+	int j;
+
+	/* A new edit makes whatever could be redone unreachable. */
+	editorUndoDrop(u->pos);
+
+	if (op == UNDO_INSERT)
+	{
+		endrow = row;
+		endcol = col;
+
+		for (j = 0; j < len; j++)
+			if (text[j] == '\n')
+			{
+				endrow++;
+				endcol = 0;
+			}
+			else
+				endcol++;
+	}
+
+	struct undoEntry *last = u->n ? &u->entries[u->n - 1] : NULL;
+
+	/* In a batch, text inserted where the previous insertion ended, such as rows */
+	/* coming in one at a time, goes into the same entry.                         */
+	if (last && u->batch && last->group == u->group && last->op == UNDO_INSERT && op == UNDO_INSERT &&
+		row == u->endrow && col == u->endcol)
+	{
+		last->text = realloc(last->text, last->len + len);
+		memcpy(&last->text[last->len], text, len);
+
+		last->len += len;
+		u->bytes += len;
+		u->endrow = endrow;
+		u->endcol = endcol;
+		free(text);
+
+		editorUndoTrim();
+		return;
+	}
+
+	if (last && !u->sealed && !u->batch && last->op == op && last->row == row &&
+		!memchr(text, '\n', len) && !memchr(last->text, '\n', last->len))
+	{
+		/* Typing continues where the previous insert ended. */
+		int append = (op == UNDO_INSERT && col == last->col + last->len) ||
+		/* The delete key eats the text after the previous deletion. */
+					 (op == UNDO_DELETE && col == last->col);
+		/* Backspace eats the text before it. */
+		int prepend = (op == UNDO_DELETE && col + len == last->col);
+
+		if (append || prepend)
+		{
+			last->text = realloc(last->text, last->len + len);
+
+			if (prepend)
+			{
+				memmove(&last->text[len], last->text, last->len);
+				memcpy(last->text, text, len);
+				last->col = col;
+			}
+
+			else
+				memcpy(&last->text[last->len], text, len);
+
+			last->len += len;
+			u->bytes += len;
+			u->endrow = append ? endrow : -1;
+			u->endcol = endcol;
+			free(text);
+
+			editorUndoTrim();
+			return;
+		}
+	}
+
+	if (u->n == u->cap)
+	{
+		u->cap = u->cap ? u->cap * 2 : 64;
+		u->entries = realloc(u->entries, sizeof(struct undoEntry) * u->cap);
+	}
+
+	struct undoEntry *e = &u->entries[u->n++];
+
+	e->op = op;
+	e->row = row;
+	e->col = col;
+	e->len = len;
+	e->text = text;
+	e->group = u->batch ? u->group : ++u->group;
+
+	u->pos = u->n;
+	u->bytes += sizeof(struct undoEntry) + len;
+	u->sealed = 0;
+	u->endrow = endrow;
+	u->endcol = endcol;
+
+	editorUndoTrim();
+}
+
+
+
+
+/* Function responsible for recording an edit in the undo log, copying its text. */
+void editorUndoRecord(int op, int row, int col, const char *s, int len)
+{
+	if (!editorUndoWanted() || !editorUndoFits(len))
+		return;
+
+	char *text = malloc(len + 1);
+	memcpy(text, s, len);
+
+	editorUndoTake(op, row, col, text, len);
+}
+
+
+
+
+/* Function responsible for stopping the next edit from being merged into the last */
+/* entry, e.g. because the cursor was moved away.                                  */
+void editorUndoSeal()
+{
+	E.undo.sealed = 1;
+}
+
+
+
+
+/* Functions responsible for grouping the edits of a bulk operation (paste, replace */
+/* all, ...), so that a single undo or redo takes back all of them.                 */
+void editorUndoBeginBatch()
+{
+	if (E.undo.batch++ == 0)
+		E.undo.group++;
+}
+
+void editorUndoEndBatch()
+{
+	if (E.undo.batch > 0)
+		E.undo.batch--;
+
+	editorUndoSeal();
+}
+
+
+
+
+/* Function responsible for applying an undo entry backwards (undo) or forwards */
+/* (redo). Each entry is a block of text, so even a bulk edit is taken back in  */
+/* one insertion or deletion rather than character by character.              */
+void editorUndoApply(struct undoEntry *e, int forward)
+{
+	if ((e->op == UNDO_INSERT) == forward)
+	{
+		kiloInsertText(&E.buf, e->row, e->col, e->text, e->len, &E.buf.cy, &E.buf.cx);
+
+		if (!forward)
+		{
+			E.buf.cy = e->row;
+			E.buf.cx = e->col;
+		}
+	}
+
+	else
+	{
+		kiloDeleteText(&E.buf, e->row, e->col, e->len);
+
+		E.buf.cy = e->row;
+		E.buf.cx = e->col;
+	}
+}
+
+
+
+
+/* Function responsible for undoing the last group of edits. */
+void editorUndo()
+{
+	struct editorUndo *u = &E.undo;
+
+	if (u->pos == 0)
+	{
+		editorSetStatusMessage("Nothing to undo");
+		return;
+	}
+
+	int group = u->entries[u->pos - 1].group;
+
+	u->applying = 1;
+
+	/* The entries of a group go back as one update: rows are rendered once. */
+	kiloBeginBatch(&E.buf);
+
+	while (u->pos > 0 && u->entries[u->pos - 1].group == group)
+		editorUndoApply(&u->entries[--u->pos], 0);
+
+	kiloEndBatch(&E.buf);
+
+	u->applying = 0;
+	editorUndoSeal();
+}
+
+
+
+
+/* Function responsible for redoing the last group of edits that was undone. */
+void editorRedo()
+{
+	struct editorUndo *u = &E.undo;
+
+	if (u->pos == u->n)
+	{
+		editorSetStatusMessage("Nothing to redo");
+		return;
+	}
+
+	int group = u->entries[u->pos].group;
+
+	u->applying = 1;
+	kiloBeginBatch(&E.buf);
+
+	while (u->pos < u->n && u->entries[u->pos].group == group)
+		editorUndoApply(&u->entries[u->pos++], 1);
+
+	kiloEndBatch(&E.buf);
+
+	u->applying = 0;
+	editorUndoSeal();
+}
+
+
+
+
+/* Function responsible for setting up the undo log. Its memory limit defaults to */
+/* KILO_UNDO_LIMIT bytes and can be changed through the KILO_UNDO_LIMIT variable. */
+void editorUndoInit()
+{
+	char *env = getenv("KILO_UNDO_LIMIT");
+
+	E.undo.entries = NULL;
+	E.undo.n = 0;
+	E.undo.cap = 0;
+	E.undo.pos = 0;
+	E.undo.bytes = 0;
+	E.undo.limit = (env && atoll(env) > 0) ? (size_t) atoll(env) : KILO_UNDO_LIMIT;
+	E.undo.group = 0;
+	E.undo.batch = 0;
+	E.undo.sealed = 0;
+	E.undo.applying = 0;
+	E.undo.endrow = -1;
+	E.undo.endcol = -1;
+	E.undo.lost = 0;
+}
+
+
+
+
+/* Function that returns a monotonic timestamp in nanoseconds. */
+long long editorNanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+
+
+
+/* Function responsible for recording how long a stage of the current frame took. */
+void editorTraceRecord(int stage, long long t0)
+{
+	E.trace.cur.start[stage] = t0;
+	E.trace.cur.dur[stage] = editorNanos() - t0;
+}
+
+
+
+
+/* Function responsible for moving the finished frame into the ring. */
+void editorTraceCommit()
+{
+	E.trace.ring[E.trace.frames % KILO_TRACE_FRAMES] = E.trace.cur;
+	E.trace.frames++;
+
+	memset(&E.trace.cur, 0, sizeof(E.trace.cur));
+}
+
+
+
+
+static int editorTraceCompare(const void *a, const void *b)
+{
+	long long x = *(const long long *) a;
+	long long y = *(const long long *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+
+
+/* Function responsible for writing the p50/p99 of every stage over the last frames, */
+/* in microseconds, for the status bar overlay. Returns the length written.          */
+int editorTraceSummary(char *buf, int size)
+{
+	static const char *names[TRACE_STAGES] = { "key", "edit", "scrl", "draw", "wr" };
+	long long d[KILO_TRACE_WINDOW];
+	int n = (E.trace.frames < KILO_TRACE_WINDOW) ? E.trace.frames : KILO_TRACE_WINDOW;
+	int len = snprintf(buf, size, "p50/p99us");
+	int stage, i;
+
+	for (stage = 0; stage < TRACE_STAGES && len < size; stage++)
+	{
+		for (i = 0; i < n; i++)
+			d[i] = E.trace.ring[(E.trace.frames - 1 - i) % KILO_TRACE_FRAMES].dur[stage];
+
+		qsort(d, n, sizeof(long long), editorTraceCompare);
+
+		len += snprintf(&buf[len], size - len, " %s %lld/%lld", names[stage],
+						n ? d[n / 2] / 1000 : 0, n ? d[(n * 99) / 100] / 1000 : 0);
+	}
+
+	return (len < size) ? len : size - 1;
+}
+
+
+
+
+/* Function responsible for dumping the ring to E.trace.path as a Chrome trace */
+/* (chrome://tracing, Perfetto) when the editor exits.                         */
+void editorTraceDump()
+{
+	static const char *names[TRACE_STAGES] = {
+		"editorReadKey", "editorProcessKeypress", "editorScroll", "editorDrawRows", "write"
+	};
+
+	FILE *fp = fopen(E.trace.path, "w");
+	if (!fp)
+		return;
+
+	long long first = (E.trace.frames > KILO_TRACE_FRAMES) ? E.trace.frames - KILO_TRACE_FRAMES : 0;
+	long long base = 0;
+	long long f;
+	int stage;
+	int sep = 0;
+
+	fprintf(fp, "{\"traceEvents\": [\n");
+
+	for (f = first; f < E.trace.frames; f++)
+	{
+		struct traceFrame *tf = &E.trace.ring[f % KILO_TRACE_FRAMES];
+
+		for (stage = 0; stage < TRACE_STAGES; stage++)
+		{
+			/* Frames drawn without a key press have no decode or edit stage. */
+			if (tf->start[stage] == 0)
+				continue;
+
+			if (base == 0)
+				base = tf->start[stage];
+
+			fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+					"\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %lld}}",
+					sep ? ",\n" : "", names[stage], (tf->start[stage] - base) / 1000.0,
+					tf->dur[stage] / 1000.0, f);
+			sep = 1;
+		}
+	}
+
+	fprintf(fp, "\n], \"displayTimeUnit\": \"ns\"}\n");
+	fclose(fp);
+}
+
+
+
+
+/* Function responsible for turning tracing on; the ring is only allocated then. */
+void editorTraceEnable()
+{
+	if (E.trace.ring == NULL)
+		E.trace.ring = calloc(KILO_TRACE_FRAMES, sizeof(struct traceFrame));
+
+	E.trace.enabled = 1;
+}
+
+
+
+
+/* Function responsible for the overlay key binding. Tracing stays on afterwards */
+/* when a trace file was asked for.                                              */
+void editorTraceToggleOverlay()
+{
+	E.trace.overlay = !E.trace.overlay;
+
+	if (E.trace.overlay)
+		editorTraceEnable();
+	else if (E.trace.path == NULL)
+		E.trace.enabled = 0;
+}
+
+
+
+
+/* Function responsible for setting up tracing from the KILO_TRACE variable. */
+void editorTraceInit()
+{
+	memset(&E.trace, 0, sizeof(E.trace));
+
+	char *path = getenv("KILO_TRACE");
+	if (path == NULL || *path == '\0')
+		return;
+
+	E.trace.path = strdup(path);
+	editorTraceEnable();
+	atexit(editorTraceDump);
+}
+
+
+
+
+/* Function that returns what the clipboard holds: its rows and their text. */
+size_t editorClipMem()
+{
+	if (E.clip == NULL)
+		return 0;
+
+	return E.clip->mem + kiloMemSize(E.clip->rows) + kiloMemSize(E.clip);
+}
+
+
+
+
+/* Function that adds up the caches and logs that are not tracked allocation by */
+/* allocation. Each of them is a handful of buffers, so this is cheap.          */
+size_t editorMemCaches(size_t *undo, size_t *journal, size_t *hljobs, size_t *other)
+{
+	int k;
+
+	*undo = E.undo.bytes + (E.undo.cap * sizeof(struct undoEntry));
+	*journal = E.journal.cap;
+	*hljobs = 0;
+
+	for (k = 0; k < KILO_HL_JOBS; k++)
+	{
+		struct hlJob *job = &E.hl.jobs[k];
+
+		*hljobs += (2 * (size_t) job->textcap) +
+				   (job->rowcap * (sizeof(int) * 2 + sizeof(unsigned int)));
+	}
+
+	*other = (E.buf.ndirty * sizeof(int)) + (E.fold.cap * 2 * sizeof(long long)) + (E.hex.cap * sizeof(struct hexEdit)) +
+			 (E.trace.ring ? KILO_TRACE_FRAMES * sizeof(struct traceFrame) : 0) + editorClipMem();
+
+	return *undo + *journal + *hljobs + *other;
+}
+
+
+
+
+/* Function that returns the total of everything tracked, updating the high-water mark. */
+size_t editorMemTotal()
+{
+	size_t undo, journal, hljobs, other;
+	size_t total = E.buf.mem_chars + E.buf.mem_render + E.buf.mem_rows + E.mem.frame + E.mem.transient +
+				   editorMemCaches(&undo, &journal, &hljobs, &other) + editorFilesMem();
+
+	if (total > E.mem.peak)
+		E.mem.peak = total;
+
+	return total;
+}
+
+
+
+
+/* Function responsible for moving a tracked counter from the old to the new size */
+/* of an allocation. Growth is checked against the high-water mark right away;    */
+/* the rows, counted by the buffer itself, catch up with it on every frame.       */
+void editorMemAdjust(size_t *counter, size_t oldsize, size_t newsize)
+{
+	*counter += newsize - oldsize;
+
+	if (newsize > oldsize)
+		editorMemTotal();
+}
+
+
+
+
+/* Function responsible for formatting a byte count for humans. */
+char *editorMemHuman(size_t n, char *buf, int size)
+{
+	const char *units = "BKMGT";
+	double v = n;
+
+	while (v >= 1024 && units[1])
+	{
+		v /= 1024;
+		units++;
+	}
+
+	snprintf(buf, size, (*units == 'B') ? "%.0f%c" : "%.1f%c", v, *units);
+	return buf;
+}
+
+
+
+
+/* Function that reads a "VmXXX:" line from /proc/self/status, in bytes, or 0. */
+size_t editorMemProc(const char *key)
+{
+	FILE *fp = fopen("/proc/self/status", "r");
+	char line[128];
+	size_t kb = 0;
+	int keylen = strlen(key);
+
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp))
+		if (!strncmp(line, key, keylen))
+			kb = strtoull(&line[keylen], NULL, 10);
+
+	fclose(fp);
+	return kb * 1024;
+}
+
+
+
+
+/* Function responsible for the memory report. A one line breakdown goes to the  */
+/* message bar; when KILO_MEM_REPORT names a file, the full breakdown is appended */
+/* to it as well. Content sizes are added up here, which walks the rows once.    */
+void editorMemReport()
+{
+	size_t undo, journal, hljobs, other;
+	size_t caches = editorMemCaches(&undo, &journal, &hljobs, &other);
+	size_t total = editorMemTotal();
+	size_t chars_content = 0;
+	size_t render_content = 0;
+	int j;
+
+	/* The text of shared rows is not the buffer's to count. */
+	for (j = 0; j < E.buf.numrows; j++)
+	{
+		if (!E.buf.row[j].shared)
+			chars_content += E.buf.row[j].size + 1;
+
+		render_content += (2 * (size_t) E.buf.row[j].rsize) + 1;
+	}
+
+	/* What the row buffers hold beyond their content: chunk headers, rounding and */
+	/* slack left by rows that shrank.                                             */
+	size_t overhead = (E.buf.mem_chars + E.buf.mem_render) - (chars_content + render_content);
+
+	char a[16], b[16], c[16], d[16], e[16], f[16], g[16];
+
+	editorSetStatusMessage("mem %s hwm %s: chars %s render %s rows %s ovh %s cache %s",
+						   editorMemHuman(total, a, sizeof(a)),
+						   editorMemHuman(E.mem.peak, b, sizeof(b)),
+						   editorMemHuman(chars_content, c, sizeof(c)),
+						   editorMemHuman(render_content, d, sizeof(d)),
+						   editorMemHuman(E.buf.mem_rows, e, sizeof(e)),
+						   editorMemHuman(overhead, f, sizeof(f)),
+						   editorMemHuman(caches + E.mem.frame, g, sizeof(g)));
+
+	char *path = getenv("KILO_MEM_REPORT");
+	if (path == NULL || *path == '\0')
+		return;
+
+	FILE *fp = fopen(path, "a");
+	if (!fp)
+		return;
+
+	fprintf(fp, "kilo memory report: %s, %d rows\n", E.filename ? E.filename : "[No Name]", E.buf.numrows);
+	fprintf(fp, "  %-22s %14zu  (%d rows of %d in use)\n", "erow array", E.buf.mem_rows, E.buf.numrows, E.buf.rowcap);
+	fprintf(fp, "  %-22s %14zu  (%zu held)\n", "chars", chars_content, E.buf.mem_chars);
+	fprintf(fp, "  %-22s %14zu  (%zu held)\n", "render + hl", render_content, E.buf.mem_render);
+	fprintf(fp, "  %-22s %14zu  (%lld allocations)\n", "allocator overhead", overhead, E.buf.nalloc);
+	fprintf(fp, "  %-22s %14zu  (peak %zu)\n", "frame buffer", E.mem.frame, E.mem.frame_peak);
+	fprintf(fp, "  %-22s %14zu  (%d entries)\n", "undo log", undo, E.undo.n);
+	fprintf(fp, "  %-22s %14zu\n", "journal buffer", journal);
+	fprintf(fp, "  %-22s %14zu\n", "highlight jobs", hljobs);
+	fprintf(fp, "  %-22s %14zu\n", "dirty list, folds, trace", other - editorClipMem());
+	fprintf(fp, "  %-22s %14zu  (%d rows)\n", "clipboard", editorClipMem(), E.clip ? E.clip->numrows : 0);
+	fprintf(fp, "  %-22s %14zu  (%d open, budget %zu)\n", "other files", editorFilesMem(), E.files.n, E.files.budget);
+	fprintf(fp, "  %-22s %14zu\n", "total tracked", total);
+	fprintf(fp, "  %-22s %14zu\n", "high-water mark", E.mem.peak);
+	fprintf(fp, "  %-22s %14zu  (peak %zu)\n", "process RSS", editorMemProc("VmRSS:"), editorMemProc("VmHWM:"));
+	fclose(fp);
+}
+
+
+
+
+/* Function responsible for setting up the list of open files, holding the empty */
+/* buffer kilo starts with. The memory budget can be set through KILO_MEM_BUDGET. */
+void editorFilesInit()
+{
+	char *env = getenv("KILO_MEM_BUDGET");
+
+	E.files.list = calloc(1, sizeof(struct editorFile));
+	E.files.n = 1;
+	E.files.cur = 0;
+	E.files.clock = 0;
+	E.files.budget = (env && atoll(env) > 0) ? (size_t) atoll(env) : KILO_MEM_BUDGET;
+}
+
+
+
+
+/* Function responsible for adding a file to the list without reading it yet; */
+/* that is done the first time it is switched to.                             */
+void editorFilesAdd(const char *filename)
+{
+	E.files.list = realloc(E.files.list, sizeof(struct editorFile) * (E.files.n + 1));
+
+	struct editorFile *f = &E.files.list[E.files.n++];
+
+	memset(f, 0, sizeof(*f));
+	kiloBufferInit(&f->buf, &editorBufferHooks);
+
+	f->filename = strdup(filename);
+	f->disk_size = -1;
+	f->disk_mtime = -1;
+	f->journal.fd = -1;
+	f->journal.last = -1;
+	f->undo.limit = E.undo.limit;
+	f->mark = -1;
+	f->hex.fd = -1;
+	f->evicted = 1;
+}
+
+
+
+
+/* Functions responsible for moving the state of a file out of E, when it goes */
+/* off screen, and back into E when it comes back.                             */
+void editorFileStash(struct editorFile *f)
+{
+	f->buf = E.buf;
+	f->rx = E.rx;
+	f->rowoff = E.rowoff;
+	f->coloff = E.coloff;
+	f->filename = E.filename;
+	f->syntax = E.syntax;
+	f->gzip = E.gzip;
+	f->disk_size = E.disk_size;
+	f->disk_mtime = E.disk_mtime;
+	f->journal = E.journal;
+	f->undo = E.undo;
+	f->shared = E.shared;
+	f->shared_len = E.shared_len;
+	f->mark = E.mark;
+	f->folds = E.fold.count;
+	f->hex = E.hex;
+	f->unready = E.hl.unready;
+}
+
+void editorFileRestore(struct editorFile *f)
+{
+	E.buf = f->buf;
+	E.rx = f->rx;
+	E.rowoff = f->rowoff;
+	E.coloff = f->coloff;
+	E.filename = f->filename;
+	E.syntax = f->syntax;
+	E.gzip = f->gzip;
+	E.disk_size = f->disk_size;
+	E.disk_mtime = f->disk_mtime;
+	E.journal = f->journal;
+	E.undo = f->undo;
+	E.shared = f->shared;
+	E.shared_len = f->shared_len;
+	E.mark = f->mark;
+	E.fold.count = f->folds;
+	E.fold.stale = 1;
+	E.hex = f->hex;
+	E.hl.unready = f->unready;
+}
+
+
+
+
+/* Function that tells whether a file holds nothing but what is on disk, so that */
+/* its rows can be dropped and read back later.                                  */
+int editorFileClean(struct editorFile *f)
+{
+	return f->filename != NULL && f->buf.ndirty == 0 && !f->buf.layout_changed && f->journal.len == 0 &&
+		   f->hex.nedits == 0;
+}
+
+
+
+
+/* Function responsible for dropping the rows of a file that is not on screen. */
+/* The undo log and the cursor are kept for when the file is read back in.     */
+void editorFileEvict(struct editorFile *f)
+{
+	int cx = f->buf.cx;
+	int cy = f->buf.cy;
+
+	kiloBufferFree(&f->buf);
+
+	if (f->shared)
+		munmap(f->shared, f->shared_len);
+
+	f->shared = NULL;
+	editorHexClose(&f->hex);
+	f->buf.cx = cx;
+	f->buf.cy = cy;
+	f->unready = 0;
+	f->folds = 0;
+	f->evicted = 1;
+}
+
+
+
+
+/* Function responsible for reading the rows of the file in E from disk, the first */
+/* time it is looked at or after they were dropped. The undo log only still fits  */
+/* the rows if the file has not changed on disk in the meantime.                  */
+void editorFileLoad()
+{
+	char *name = strdup(E.filename);
+	off_t size = E.disk_size;
+	long long mtime = E.disk_mtime;
+	int cx = E.buf.cx;
+	int cy = E.buf.cy;
+	char msg[sizeof(E.statusmsg)];
+
+	/* Loading puts its progress on the message bar; what was there comes back after. */
+	memcpy(msg, E.statusmsg, sizeof(msg));
+	editorOpen(name);
+	editorSetStatusMessage("%s", msg);
+	free(name);
+
+	E.buf.cy = (cy > E.buf.numrows) ? E.buf.numrows : cy;
+	E.buf.cx = 0;
+
+	if (E.buf.cy < E.buf.numrows && cx <= E.buf.row[E.buf.cy].size)
+		E.buf.cx = kiloRowSnap(&E.buf.row[E.buf.cy], cx);
+
+	if (size != -1 && (E.disk_size != size || E.disk_mtime != mtime) && E.undo.n > 0)
+	{
+		editorUndoDrop(0);
+		editorSetStatusMessage("%.40s changed on disk, undo history dropped", E.filename);
+	}
+
+	editorJournalInit();
+	editorJournalRecover();
+}
+
+
+
+
+/* Function responsible for putting file "to" of the list on screen. The list */
+/* wraps around at both ends.                                                 */
+void editorFilesSwitch(int to)
+{
+	struct editorFiles *fs = &E.files;
+
+	if (fs->n < 2)
+	{
+		editorSetStatusMessage("No other file is open");
+		return;
+	}
+
+	to = (to + fs->n) % fs->n;
+
+	struct editorFile *next = &fs->list[to];
+
+	if (next->evicted && access(next->filename, R_OK) == -1)
+	{
+		editorSetStatusMessage("Can't open %.40s: %s", next->filename, strerror(errno));
+		return;
+	}
+
+	/* Whatever the file on screen has pending goes to disk before it is put away. */
+	editorUndoSeal();
+	editorJournalFlush();
+
+	editorFileStash(&fs->list[fs->cur]);
+	fs->list[fs->cur].viewed = ++fs->clock;
+
+	fs->cur = to;
+	editorFileRestore(next);
+
+	/* The highlighting jobs in flight are for the rows of the other file. */
+	E.hl.epoch++;
+	E.hl.scan = 0;
+
+	editorSetStatusMessage("File %d/%d: %.40s", to + 1, fs->n, E.filename ? E.filename : "[No Name]");
+
+	if (next->evicted)
+	{
+		next->evicted = 0;
+		editorFileLoad();
+	}
+}
+
+
+
+
+/* Function that adds up what the files that are not on screen hold. */
+size_t editorFilesMem()
+{
+	size_t total = 0;
+	int k;
+
+	for (k = 0; k < E.files.n; k++)
+	{
+		struct editorFile *f = &E.files.list[k];
+
+		if (k == E.files.cur)
+			continue;
+
+		total += f->buf.mem_chars + f->buf.mem_render + f->buf.mem_rows + f->journal.cap +
+				 f->undo.bytes + (f->undo.cap * sizeof(struct undoEntry)) + (f->hex.cap * sizeof(struct hexEdit));
+	}
+
+	return total;
+}
+
+
+
+
+/* Function responsible for bringing the open files back under the memory budget, */
+/* by dropping the rows of clean files that are not on screen, the least recently */
+/* viewed first. Files with unsaved edits are never dropped.                      */
+void editorFilesTrim()
+{
+	while (editorMemTotal() > E.files.budget)
+	{
+		struct editorFile *victim = NULL;
+		int k;
+
+		for (k = 0; k < E.files.n; k++)
+		{
+			struct editorFile *f = &E.files.list[k];
+
+			if (k == E.files.cur || f->evicted || !editorFileClean(f))
+				continue;
+
+			if (victim == NULL || f->viewed < victim->viewed)
+				victim = f;
+		}
+
+		if (victim == NULL)
+			break;
+
+		editorFileEvict(victim);
+	}
+}
+
+
+
+
+/* Function responsible for throwing the journals of every open file away, when */
+/* the editor is quit on purpose.                                               */
+void editorFilesQuit()
+{
+	int k;
+
+	editorJournalReset();
+
+	for (k = 0; k < E.files.n; k++)
+		if (k != E.files.cur)
+			editorJournalDiscard(&E.files.list[k].journal);
+}
+
+
+
+
+/* structure that defines our append buffer. Creates a dynamic/mutable string type. */
+struct abuf
+{
+	char *b;
+	int len;
+};
+
+/* This defines works as a contructor would in C++. The constant definition defines */
+/* what exactly an empty buffer is.													*/
+#define ABUF_INIT {NULL, 0}
+
+
+
+
+
+/* Function that defines append operations on the append buffer/"abuf". */
+void abAppend(struct abuf *ab, const char *s, int len)
+{
+	char *new = realloc(ab->b, ab->len + len);
+
+	if (new == NULL)
+		return;
+
+	memcpy(&new[ab->len], s, len);
+	ab->b = new;
+	ab->len += len;
+}
+
+
+
+
+
+/* Function that defines how to free the memory allocated to an instance of the abuf. */
+void abFree(struct abuf *ab)
+{
+	free(ab->b);
+}
+
+
+
+
+
+/* Function responsible for opening a file in the hex view, when it is binary or */
+/* "kilo --hex" asked for it. The file is mapped, not read, so this takes the    */
+/* same time and memory whatever its size. Returns -1, having touched nothing,   */
+/* when the file is to be read into rows instead.                                */
+int editorHexOpen(const char *filename)
+{
+	int writable = 0;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd == -1)
+		return -1;
+
+	/* Compressed files hold NUL bytes too, but they are text once inflated. */
+	unsigned char sniff[KILO_HEX_SNIFF];
+	ssize_t n = pread(fd, sniff, sizeof(sniff), 0);
+	int gzip = (n >= 2 && sniff[0] == 0x1f && sniff[1] == 0x8b);
+	int binary = (n > 0 && !gzip && memchr(sniff, '\0', n) != NULL);
+	struct stat st;
+
+	if ((!binary && !E.hexall) || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+	{
+		close(fd);
+		return -1;
+	}
+
+	/* Only now that the file is to be shown is it opened for writing, and only */
+	/* kept so when it is still the file that was looked at.                   */
+	int rw = open(filename, O_RDWR);
+	struct stat rst;
+
+	if (rw != -1 && fstat(rw, &rst) == 0 && rst.st_dev == st.st_dev && rst.st_ino == st.st_ino)
+	{
+		close(fd);
+		fd = rw;
+		writable = 1;
+	}
+
+	else if (rw != -1)
+		close(rw);
+
+	unsigned char *map = NULL;
+
+	if (st.st_size > 0 && (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		close(fd);
+		return -1;
+	}
+
+	/* The cursor is kept from before the file was dropped, when it still fits. */
+	E.hex.on = 1;
+	E.hex.fd = fd;
+	E.hex.writable = writable;
+	E.hex.map = map;
+	E.hex.size = st.st_size;
+	E.hex.nibble = 0;
+
+	if (E.hex.cur >= E.hex.size)
+		E.hex.cur = E.hex.top = 0;
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for unmapping a file shown in the hex view. The bytes */
+/* typed over and not written are lost; the cursor is kept.                  */
+void editorHexClose(struct editorHex *h)
+{
+	if (!h->on)
+		return;
+
+	if (h->map)
+		munmap(h->map, h->size);
+
+	close(h->fd);
+	free(h->edits);
+
+	h->on = 0;
+	h->fd = -1;
+	h->map = NULL;
+	h->edits = NULL;
+	h->nedits = 0;
+	h->cap = 0;
+}
+
+
+
+
+/* Function responsible for following the file under the hex view when another */
+/* process has made it shorter or longer. A byte of the map past the end of the */
+/* file raises SIGBUS when it is read, so this is called before the map is used */
+/* and maps the file again at its new size, dropping what was typed past it.    */
+void editorHexCheck()
+{
+	struct editorHex *h = &E.hex;
+	struct stat st;
+
+	if (fstat(h->fd, &st) == -1 || st.st_size == h->size)
+		return;
+
+	if (h->map)
+		munmap(h->map, h->size);
+
+	h->map = NULL;
+	h->size = 0;
+
+	if (st.st_size > 0 && (h->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, h->fd, 0)) == MAP_FAILED)
+		h->map = NULL;
+
+	else
+		h->size = st.st_size;
+
+	while (h->nedits > 0 && h->edits[h->nedits - 1].off >= h->size)
+		h->nedits--;
+
+	if (h->cur >= h->size)
+	{
+		h->cur = (h->size > 0) ? h->size - 1 : 0;
+		h->nibble = 0;
+	}
+
+	if (h->top * KILO_HEX_ROW > h->cur)
+		h->top = h->cur / KILO_HEX_ROW;
+
+	editorSetStatusMessage("%.40s changed size on disk: %lld bytes", E.filename, h->size);
+}
+
+
+
+
+/* Function that finds where the byte at "off" is, or would go, among the bytes */
+/* typed over, by binary search.                                                */
+int editorHexFind(long long off)
+{
+	int lo = 0;
+	int hi = E.hex.nedits;
+
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+
+		if (E.hex.edits[mid].off < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
+
+
+/* Function that returns the byte at "off" as it is shown: typed over, or the */
+/* one in the file.                                                           */
+int editorHexByte(long long off)
+{
+	int k = editorHexFind(off);
+
+	if (k < E.hex.nedits && E.hex.edits[k].off == off)
+		return E.hex.edits[k].byte;
+
+	return E.hex.map[off];
+}
+
+
+
+
+/* Function responsible for typing a hex digit over the digit of the byte under */
+/* the cursor, and moving on to the next digit. A byte typed back to what the   */
+/* file holds is no longer an edit.                                             */
+void editorHexType(int digit)
+{
+	struct editorHex *h = &E.hex;
+
+	if (h->size == 0)
+		return;
+
+	if (!h->writable)
+	{
+		editorSetStatusMessage("%.40s is read-only", E.filename);
+		return;
+	}
+
+	int k = editorHexFind(h->cur);
+	int byte = editorHexByte(h->cur);
+	int found = (k < h->nedits && h->edits[k].off == h->cur);
+
+	byte = h->nibble ? ((byte & 0xf0) | digit) : ((digit << 4) | (byte & 0x0f));
+
+	if (byte == h->map[h->cur] && found)
+	{
+		memmove(&h->edits[k], &h->edits[k + 1], sizeof(struct hexEdit) * (h->nedits - k - 1));
+		h->nedits--;
+	}
+
+	else if (byte != h->map[h->cur])
+	{
+		if (!found)
+		{
+			if (h->nedits == h->cap)
+			{
+				h->cap = h->cap ? h->cap * 2 : 64;
+				h->edits = realloc(h->edits, sizeof(struct hexEdit) * h->cap);
+			}
+
+			memmove(&h->edits[k + 1], &h->edits[k], sizeof(struct hexEdit) * (h->nedits - k));
+			h->edits[k].off = h->cur;
+			h->nedits++;
+		}
+
+		h->edits[k].byte = byte;
+	}
+
+	if (h->nibble == 0)
+		h->nibble = 1;
+
+	else
+	{
+		h->nibble = 0;
+
+		if (h->cur < h->size - 1)
+			h->cur++;
+	}
+}
+
+
+
+
+/* Function responsible for writing the bytes typed over back into the file, in */
+/* place with pwrite(), a run of neighbouring bytes at a time. Nothing else of  */
+/* the file is read or written, however large it is.                            */
+void editorHexSave()
+{
+	struct editorHex *h = &E.hex;
+	unsigned char run[4096];
+	int written = 0;
+	int k = 0;
+
+	if (h->nedits == 0)
+	{
+		editorSetStatusMessage("No changes to write");
+		return;
+	}
+
+	while (k < h->nedits)
+	{
+		long long start = h->edits[k].off;
+		int n = 0;
+
+		while (k < h->nedits && n < (int) sizeof(run) && h->edits[k].off == start + n)
+			run[n++] = h->edits[k++].byte;
+
+		/* Whatever was not written stays typed over, so saving again retries all of it. */
+		if (pwrite(h->fd, run, n, start) != n)
+		{
+			editorSetStatusMessage("Can't save ! I/O error: %s", strerror(errno));
+			return;
+		}
+
+		written += n;
+	}
+
+	if (fdatasync(h->fd) == -1)
+	{
+		editorSetStatusMessage("Can't save ! I/O error: %s", strerror(errno));
+		return;
+	}
+
+	/* The file is mapped shared, so the map already holds what was written. */
+	h->nedits = 0;
+	editorStatDisk();
+
+	editorSetStatusMessage("%d bytes written to disk in place", written);
+}
+
+
+
+
+/* Function that returns the screen column of byte "j" of a row of the hex view: */
+/* the offset takes 12 columns, every byte 3 and the middle of the row one more. */
+int editorHexColumn(int j)
+{
+	return 12 + (j * 3) + (j >= KILO_HEX_ROW / 2);
+}
+
+
+
+
+/* Function responsible for keeping the cursor's row of the hex view on screen. */
+void editorHexScroll()
+{
+	long long row = E.hex.cur / KILO_HEX_ROW;
+
+	if (row < E.hex.top)
+		E.hex.top = row;
+
+	if (row >= E.hex.top + E.screenrows)
+		E.hex.top = row - E.screenrows + 1;
+}
+
+
+
+
+/* Function responsible for appending as much of "s" to a row of the hex view as */
+/* still fits on screen, counting the columns used in "col".                     */
+void editorHexPut(struct abuf *ab, int *col, const char *s, int len)
+{
+	if (len > E.screencols - *col)
+		len = E.screencols - *col;
+
+	if (len > 0)
+	{
+		abAppend(ab, s, len);
+		*col += len;
+	}
+}
+
+
+
+
+/* Function responsible for drawing the rows of the hex view: the offset, the */
+/* bytes in hex with those typed over inverted, and the bytes as text. Only   */
+/* the rows on screen are looked at, read straight out of the map.            */
+void editorHexDrawRows(struct abuf *ab)
+{
+	int y;
+
+	editorHexCheck();
+
+	for (y = 0; y < E.screenrows; y++)
+	{
+		long long off = (E.hex.top + y) * KILO_HEX_ROW;
+
+		if (off >= E.hex.size && off > 0)
+			abAppend(ab, "~", 1);
+
+		else
+		{
+			char text[KILO_HEX_ROW];
+			char buf[32];
+			int k = editorHexFind(off);
+			int col = 0;
+			int j;
+
+			editorHexPut(ab, &col, buf, snprintf(buf, sizeof(buf), "%010llx  ", off));
+
+			for (j = 0; j < KILO_HEX_ROW && off + j < E.hex.size; j++)
+			{
+				int byte = E.hex.map[off + j];
+				int edited = (k < E.hex.nedits && E.hex.edits[k].off == off + j);
+
+				if (edited)
+				{
+					byte = E.hex.edits[k++].byte;
+					abAppend(ab, "\x1b[7m", 4);
+				}
+
+				editorHexPut(ab, &col, buf, snprintf(buf, sizeof(buf), "%02x", byte));
+
+				if (edited)
+					abAppend(ab, "\x1b[m", 3);
+
+				editorHexPut(ab, &col, "  ", (j == KILO_HEX_ROW / 2 - 1) ? 2 : 1);
+				text[j] = isprint(byte) ? byte : '.';
+			}
+
+			/* The text column lines up even on the short last row. */
+			while (col < editorHexColumn(KILO_HEX_ROW) && col < E.screencols)
+				editorHexPut(ab, &col, " ", 1);
+
+			editorHexPut(ab, &col, " ", 1);
+			editorHexPut(ab, &col, text, j);
+		}
+
+		abAppend(ab, "\x1b[K", 3);
+		abAppend(ab, "\r\n", 2);
+	}
+}
+
+
+
+
+/* Function that handles a key in the hex view: moving by byte, row and page or */
+/* to an offset, typing hex digits over bytes and saving them. Returns 0 for    */
+/* the keys that do the same as in the text view, such as quitting.             */
+int editorHexKey(int c)
+{
+	editorHexCheck();
+
+	struct editorHex *h = &E.hex;
+	long long page = (long long) E.screenrows * KILO_HEX_ROW;
+	long long to = h->cur;
+
+	switch (c)
+	{
+		case CTRL_KEY('q'):
+		case CTRL_KEY('n'):
+		case CTRL_KEY('p'):
+		case CTRL_KEY('g'):
+		case CTRL_KEY('t'):
+		case CTRL_KEY('l'):
+		case '\x1b':
+			return 0;
+
+		case CTRL_KEY('s'):
+			editorHexSave();
+			return 1;
+
+		/* Paging through gigabytes would take a while; Ctrl-O jumps instead. */
+		case CTRL_KEY('o'):
+			{
+				char *off = editorPrompt("Go to offset (hex): ");
+
+				if (off == NULL)
+					return 1;
+
+				to = strtoll(off, NULL, 16);
+				free(off);
+			}
+
+			break;
+
+		case ARROW_LEFT:
+			to--;
+			break;
+
+		case ARROW_RIGHT:
+			to++;
+			break;
+
+		case ARROW_UP:
+			to -= KILO_HEX_ROW;
+			break;
+
+		case ARROW_DOWN:
+			to += KILO_HEX_ROW;
+			break;
+
+		case PAGE_UP:
+			to -= page;
+			break;
+
+		case PAGE_DOWN:
+			to += page;
+			break;
+
+		case HOME_KEY:
+			to -= to % KILO_HEX_ROW;
+			break;
+
+		case END_KEY:
+			to += KILO_HEX_ROW - 1 - (to % KILO_HEX_ROW);
+			break;
+
+		default:
+			if (c < 128 && isxdigit(c))
+				editorHexType(isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+			else
+				editorSetStatusMessage("Type hex digits over the byte under the cursor");
+
+			return 1;
+	}
+
+	/* Moving past either end of the file stops there. */
+	if (to > h->size - 1)
+		to = h->size - 1;
+	if (to < 0)
+		to = 0;
+
+	h->cur = to;
+	h->nibble = 0;
+
+	return 1;
+}
+
+
+
+
+/* Function responsible for handling the vertical scroll of the editor. */
+void editorScroll()
+{
+	if (E.hex.on)
+	{
+		editorHexScroll();
+		return;
+	}
+
+	E.rx = 0;
+
+	/* Neither the cursor nor the top of the screen rest on a folded away row; */
+	/* they go to the row it is folded under.                                  */
+	if (editorFoldHidden(E.buf.cy))
+	{
+		E.buf.cy = editorFoldHeader(E.buf.cy);
+		E.buf.cx = 0;
+	}
+
+	if (editorFoldHidden(E.rowoff))
+		E.rowoff = editorFoldHeader(E.rowoff);
+
+	if (E.buf.cy < E.buf.numrows)
+		E.rx = kiloRowCxToRx(&E.buf.row[E.buf.cy], E.buf.cx);
+
+	/* Scrolling counts the rows on screen, which skips folded ones. */
+	int cy = editorFoldIndex(E.buf.cy);
+	int top = editorFoldIndex(E.rowoff);
+
+	if (cy < top)
+		E.rowoff = E.buf.cy;
+
+	if (cy >= (top + E.screenrows))
+		E.rowoff = editorFoldRow(cy - E.screenrows + 1);
+
+	if (E.rx < E.coloff)
+		E.coloff = E.rx;
+
+	if (E.rx >= (E.coloff + E.screencols))
+		E.coloff = (E.rx - (E.screencols + 1));	
+}
+
+
+
+
+
+/* Function that draws rows of tildes, like VIM does. */
+void editorDrawRows(struct abuf *ab)
+{
+	if (E.hex.on)
+	{
+		editorHexDrawRows(ab);
+		return;
+	}
+
+	char *window = malloc(E.screencols);
+	int top = editorFoldIndex(E.rowoff);
+	int y;
+	for (y = 0; y < E.screenrows; y++)
+	{
+		int filerow = editorFoldRow(top + y);
+
+		if (filerow >= E.buf.numrows) 
+		{
+			if (E.buf.numrows == 0 && y == (E.screenrows / 3))
+			{
+				char welcome[80];
+				int welcomelen = snprintf(welcome, sizeof(welcome), 
+						"kilo editor -- version %s", KILO_VERSION);
+				if (welcomelen > E.screencols)
+					welcomelen = E.screencols;
+
+				/* Now we handle the condition if the terminal window is too small to */
+				/* Display the entire contents of the welcome message, by truncating  */
+				/* the message into a series of strings, thus making the message      */
+				/* viewable...														  */
+				int padding = (E.screencols - welcomelen) / 2;
+
+				if (padding)
+				{
+					abAppend(ab, "~", 1);
+					padding--;
+				}
+
+				while (padding--) 
+					abAppend(ab, " ", 1);
+
+				abAppend(ab, welcome, welcomelen);
+			}	
+		
+		else
+			abAppend(ab, "~", 1);
+		}
+		
+		else
+		{
+			erow *row = &E.buf.row[filerow];
+
+			kiloRowRender(&E.buf, row);
+
+			/* Columns of a wide character cut by the left edge, drawn as spaces. */
+			int cut = 0;
+			int off = kiloRowRenderOffset(row, E.coloff, &cut);
+			int len = row->rsize - off;
+			/* UTF-8 rows are drawn a character at a time, counting columns. */
+			int utf8 = !row->ascii && row->rope == NULL;
+			int cols = E.screencols;
+			char *c;
+			unsigned char *hl;
+
+			if (!utf8 && len > E.screencols) 
+				len = E.screencols;
+
+			/* Long rows are not rendered as a whole: only the columns on screen */
+			/* are pulled out of them, and they are drawn plain.                 */
+			if (row->rope)
+			{
+				len = kiloRowWindow(row, E.coloff, E.screencols, window);
+				c = window;
+				hl = NULL;
+			}
+
+			else
+			{
+				c = &row->render[off];
+				/* Rows the background highlighter hasn't got to yet are drawn plain. */
+				hl = row->hl_ready ? &row->hl[off] : NULL;
+			}
+			int current_color = -1;
+			int j, n;
+
+			for (; cut > 0 && cols > 0; cut--, cols--)
+				abAppend(ab, " ", 1);
+
+			/* Only emit a colour escape where the highlight class changes. */
+			for (j = 0; j < len; j += n)
+			{
+				int cp = (unsigned char) c[j];
+
+				n = 1;
+
+				if (utf8)
+				{
+					int width;
+
+					n = kiloUtf8Decode(&c[j], len - j, &cp);
+					width = kiloCharWidth(cp);
+
+					if (width > cols)
+						break;
+
+					cols -= width;
+				}
+
+				/* Control characters, C1 controls and bytes that are not valid */
+				/* UTF-8, or any byte past ASCII in a long row, are one column. */
+				if (cp < 0x20 || (cp >= 0x7f && cp < 0xa0) || (!utf8 && cp >= 0x80))
+				{
+					/* Show control characters as inverted '@'..'Z', or '?'. */
+					char sym = (cp <= 26) ? '@' + cp : '?';
+
+					abAppend(ab, "\x1b[7m", 4);
+					abAppend(ab, &sym, 1);
+					abAppend(ab, "\x1b[m", 3);
+
+					if (current_color != -1)
+					{
+						char buf[16];
+						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
+						abAppend(ab, buf, clen);
+					}
+				}
+
+				else if (hl == NULL || hl[j] == HL_NORMAL)
+				{
+					if (current_color != -1)
+					{
+						abAppend(ab, "\x1b[39m", 5);
+						current_color = -1;
+					}
+
+					abAppend(ab, &c[j], n);
+				}
+
+				else
+				{
+					int color = editorSyntaxToColor(hl[j]);
+
+					if (color != current_color)
+					{
+						char buf[16];
+						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+						abAppend(ab, buf, clen);
+						current_color = color;
+					}
+
+					abAppend(ab, &c[j], n);
+				}
+			}
+
+			abAppend(ab, "\x1b[39m", 5);
+
+			/* A folded row says how many rows it hides, where there is room. */
+			if (row->fold > 0)
+			{
+				char mark[32];
+				int mlen = snprintf(mark, sizeof(mark), " [+%d rows]", row->fold);
+				int used = (E.screencols - cols) + (utf8 ? 0 : len);
+
+				if (used + mlen <= E.screencols)
+				{
+					abAppend(ab, "\x1b[7m", 4);
+					abAppend(ab, mark, mlen);
+					abAppend(ab, "\x1b[m", 3);
+				}
+			}
+		}
+		
+		/* Allows the terminal to clear the line that is outside of the render, as */
+		/* the user scrolls up and down a file. 								   */
+		abAppend(ab, "\x1b[K", 3);
+
+		abAppend(ab, "\r\n", 2);
+	}
+
+	free(window);
+}
+
+
+
+
+
+/* Function responsible for drawing the status bar at the bottom of the editor. */
+void editorDrawStatusBar(struct abuf *ab)
+{
+	/* "\x1b[7m sets the text to inverted colour mode." */
+	abAppend(ab, "\x1b[7m", 4);
+	/* The char buffer "status" will be used to store the file's name.     */
+	/* The char buffer "rstatus" will be used to store the line number, at */
+	/* the right side of the status bar.								   */
+	char status[160];
+	char rstatus[80];
+	int len;
+	
+	/* Configure the length of the string, while checking if there is a specified name. */
+	/* If there is no name specified, len is equal to the length of "[No Name]"         */
+	if (E.trace.overlay)
+		len = editorTraceSummary(status, sizeof(status));
+	else if (E.hex.on)
+		len = snprintf(status, sizeof(status), "%.20s - %lld bytes%s", E.filename, E.hex.size,
+				E.hex.nedits ? " (modified)" : "");
+	else
+		len = snprintf(status, sizeof(status), "%.20s - %d lines",
+				E.filename ? E.filename : "[No Name]", E.buf.numrows);
+
+	/* Which of the open files this is, when there is more than one. */
+	if (!E.trace.overlay && E.files.n > 1)
+		len += snprintf(&status[len], sizeof(status) - len, " [%d/%d]", E.files.cur + 1, E.files.n);
+
+	/* The length of the string stored at the right side of the status bar is equal to the */
+	/* the length of the Cursor's y position and the Current row\line number.              */
+	int rlen = E.hex.on ? snprintf(rstatus, sizeof(rstatus), "hex | %llx/%llx", E.hex.cur, E.hex.size)
+						: snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+								   E.syntax ? E.syntax->filetype : "no ft", E.buf.cy + 1, E.buf.numrows);
+
+	/* Check the bounds of the string. If it satisfies the bounds, append the file's name */
+	/* to the status bar.																  */
+	if (len > E.screencols)
+		len = E.screencols;
+
+	abAppend(ab, status, len);
+
+	/* Draw the status bar such that the current position is within the bounds of len. */
+	while (len < E.screencols)
+	{
+		/* This IF-ELSE structure calculates the centered positioning of the string to be  */
+		/* displayed, relative to its designated area on the status bar. If it is centered */
+		/* the string is appended to the status bar.									   */
+		if ((E.screencols - len) == rlen)
+		{
+			abAppend(ab, rstatus, rlen);
+			break;
+		}
+
+		else
+		{
+			abAppend(ab, " ", 1);
+			len++;
+		}
+	}
+
+	/* This append function uses the "\x1b[m" which turns off inverted text mode. */
+	abAppend(ab, "\x1b[m", 3);
+	abAppend(ab, "\r\n", 2);
+}
+
+
+
+
+/* Function responsible for generating/displaying the message bar. */
+void editorDrawMessageBar(struct abuf *ab)
+{
+	/* No cursor on the message bar, thanks... */
+	abAppend(ab, "\x1b[K", 3);
+
+	/* msglen is equal to the length of the status message. */
+	int msglen = strlen(E.statusmsg);
+
+	/* Check the bounds of the message. */
+	if (msglen > E.screencols)
+		msglen = E.screencols;
+
+	/* Center and append the status message and the time/date onto the message bar.*/
+	if (msglen && time(NULL) - E.statusmsg_time < 5)
+		abAppend(ab, E.statusmsg, msglen);
+}
+
+
+
+
+/* Function that controlls the rendering and updating of screen content. */
+void editorRefreshScreen()
+{
+	/* Call the editorScroll function to see if the renderer must move the */
+	/* verticle frame up or down by 1 position. 						   */
+	long long t0 = TRACE_BEGIN();
+	editorScroll();
+	TRACE_END(TRACE_SCROLL, t0);
+
+	t0 = TRACE_BEGIN();
+
+	struct abuf ab = ABUF_INIT;
+
+	/* Gets rid of that annoying flickering. NOTE: "l" and "h" represent  */
+	/* "set mode" and "mode reset". The argument "?25" controlls whether  */
+	/* the cursor is shown or hidden.									  */
+	abAppend(&ab, "\x1b[?25l", 6);
+	/* Enables repositioning of the cursor. */
+	abAppend(&ab, "\x1b[H", 3);
+
+	/* Draw the background "decorations" and then reposition the cursor. */
+	editorDrawRows(&ab);
+	/* Call the routine that draws the status bar. */
+	editorDrawStatusBar(&ab);
+	/* Call the routine that is responsible for displaying the message bar. */
+	editorDrawMessageBar(&ab);
+
+	/* This segment of code will control the display of the cursors at n-position, */
+	/* As the program iterates, and the values of the cursor's x and y position    */
+	/* are updated. 															   */
+	char buf[32];
+
+	if (E.hex.on)
+		snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (int) ((E.hex.cur / KILO_HEX_ROW) - E.hex.top) + 1,
+				 editorHexColumn(E.hex.cur % KILO_HEX_ROW) + E.hex.nibble + 1);
+	else
+		snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (editorFoldIndex(E.buf.cy) - editorFoldIndex(E.rowoff)) + 1,
+				 (E.rx - E.coloff) + 1);
+	abAppend(&ab, buf, strlen(buf));
+
+	abAppend(&ab, "\x1b[?25h", 6);
+
+	TRACE_END(TRACE_BUILD, t0);
+
+	/* Reposition the cursor, and retire the current instance of the abuf. */
+	t0 = TRACE_BEGIN();
+	write(STDOUT_FILENO, ab.b, ab.len);
+	TRACE_END(TRACE_WRITE, t0);
+
+	E.mem.frame = kiloMemSize(ab.b);
+	if (E.mem.frame > E.mem.frame_peak)
+		E.mem.frame_peak = E.mem.frame;
+
+	if (editorMemTotal() > E.files.budget)
+		editorFilesTrim();
+
+	abFree(&ab);
+
+	if (E.trace.enabled)
+		editorTraceCommit();
+}
+
+
+
+
+
+/* Function responsible for configuring the status bar message and time/date. */
+void editorSetStatusMessage(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+
+	vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+	
+	va_end(ap);
+
+	E.statusmsg_time = time(NULL);
+}
+
+
+
+
+/* Function responsible for asking for a line of text on the message bar, which */
+/* shows "prompt" followed by what has been typed so far. Returns the text,      */
+/* which the caller is to free(), or NULL when escape was pressed.               */
+char *editorPrompt(const char *prompt)
+{
+	size_t cap = 128;
+	size_t len = 0;
+	char *buf = malloc(cap);
+
+	buf[0] = '\0';
+
+	while (1)
+	{
+		editorSetStatusMessage("%s%s", prompt, buf);
+		editorRefreshScreen();
+
+		int c = editorReadKey();
+
+		if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
+		{
+			if (len > 0)
+				buf[--len] = '\0';
+		}
+
+		else if (c == '\x1b')
+		{
+			editorSetStatusMessage("");
+			free(buf);
+			return NULL;
+		}
+
+		else if (c == '\r' && len > 0)
+		{
+			editorSetStatusMessage("");
+			return buf;
+		}
+
+		else if (c < 128 && !iscntrl(c))
+		{
+			if (len + 1 == cap)
+			{
+				cap *= 2;
+				buf = realloc(buf, cap);
+			}
+
+			buf[len++] = c;
+			buf[len] = '\0';
+		}
+	}
+}
+
+
+
+
+/* Function responsible for splitting what a filter wrote into rows of "out". */
+/* "*open" is set while the last row still waits for the rest of its line.   */
+void editorFilterOutput(struct kiloBuffer *out, const char *p, int len, int *open)
+{
+	const char *end = p + len;
+
+	while (p < end)
+	{
+		const char *nl = memchr(p, '\n', end - p);
+		int linelen = (nl ? nl : end) - p;
+
+		if (*open)
+			kiloRowAppend(out, &out->row[out->numrows - 1], p, linelen);
+		else
+			kiloAppendRow(out, p, linelen);
+
+		*open = (nl == NULL);
+		p = nl ? nl + 1 : end;
+	}
+}
+
+
+
+
+/* Function responsible for running rows [from, from + n) through the shell     */
+/* command "cmd" and replacing them with what it writes out, as a single edit.  */
+/* The rows are written to the command straight from the buffer while its      */
+/* output is read back into rows of their own, all in one poll() loop, so that  */
+/* neither side can block the other and no more than a pipe's worth of the     */
+/* text is ever held twice. Ctrl-C kills the command and leaves the rows be.    */
+void editorFilterRows(const char *cmd, int from, int n)
+{
+	int in[2], out[2], err[2];
+
+	if (pipe2(in, O_CLOEXEC) == -1)
+	{
+		editorSetStatusMessage("Can't run filter: %s", strerror(errno));
+		return;
+	}
+
+	if (pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1)
+	{
+		editorSetStatusMessage("Can't run filter: %s", strerror(errno));
+		close(in[0]);
+		close(in[1]);
+		return;
+	}
+
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(err[1], STDERR_FILENO);
+
+		execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+		_exit(127);
+	}
+
+	close(in[0]);
+	close(out[1]);
+	close(err[1]);
+
+	if (pid == -1)
+	{
+		editorSetStatusMessage("Can't run filter: %s", strerror(errno));
+		close(in[1]);
+		close(out[0]);
+		close(err[0]);
+		return;
+	}
 
+	fcntl(in[1], F_SETFL, O_NONBLOCK);
+	fcntl(out[0], F_SETFL, O_NONBLOCK);
+	fcntl(err[0], F_SETFL, O_NONBLOCK);
 
+	/* A command that stops reading early (head, grep -m) is not an error. */
+	struct sigaction ign, old;
 
+	memset(&ign, 0, sizeof(ign));
+	ign.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ign, &old);
 
-/* Function that defines how to free the memory allocated to an instance of the abuf. */
-void abFree(struct abuf *ab)
-{
-	free(ab->b);
-}
+	/* The output rows are only rendered once they are in the buffer. */
+	struct kiloBuffer rows;
+	kiloBufferInit(&rows, NULL);
+	kiloBeginBatch(&rows);
 
+	char *chunk = malloc(KILO_READ_CHUNK);
+	char errmsg[sizeof(E.statusmsg)];
+	int errlen = 0;
+	int open = 0;
+	int cancelled = 0;
+	int wrow = from, woff = 0;
+	long long sent = 0, received = 0;
+	long long last = editorMillis();
 
+	while (out[0] != -1 || err[0] != -1)
+	{
+		struct pollfd fds[4] = {
+			{ out[0], POLLIN, 0 },
+			{ err[0], POLLIN, 0 },
+			{ in[1], POLLOUT, 0 },
+			{ STDIN_FILENO, POLLIN, 0 }
+		};
+
+		if (poll(fds, 4, 1000) == -1 && errno != EINTR)
+			break;
 
+		if (fds[3].revents & POLLIN)
+		{
+			char c;
 
+			/* Whatever else is typed while the filter runs is dropped. */
+			if (read(STDIN_FILENO, &c, 1) == 1 && c == CTRL_KEY('c'))
+			{
+				cancelled = 1;
+				kill(pid, SIGTERM);
+				break;
+			}
+		}
 
-/* Function responsible for handling the vertical scroll of the editor. */
-void editorScroll()
-{
-	E.rx = 0;
+		if (fds[2].revents & (POLLOUT | POLLERR))
+		{
+			static char newline[] = "\n";
+			struct iovec iov[IOV_MAX];
+			int cnt = 0;
+			int j = wrow, off = woff;
 
-	if (E.cy < E.numrows)
-		E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+			/* Gather the rows, piece by piece, each followed by its newline. */
+			while (cnt < IOV_MAX - 1 && j < from + n)
+			{
+				erow *row = &E.buf.row[j];
+				const char *s = NULL;
+				int piece = 0, pos = 0, len;
 
-	if (E.cy < E.rowoff)
-		E.rowoff = E.cy;
+				while (cnt < IOV_MAX - 1 && (s = kiloRowPiece(row, &piece, &len)) != NULL)
+				{
+					if (pos + len > off)
+					{
+						int skip = (off > pos) ? off - pos : 0;
 
-	if (E.cy >= (E.rowoff + E.screenrows))
-		E.rowoff = (E.cy - E.screenrows + 1);
+						iov[cnt].iov_base = (char *) s + skip;
+						iov[cnt].iov_len = len - skip;
+						cnt++;
+					}
 
-	if (E.rx < E.coloff)
-		E.coloff = E.rx;
+					pos += len;
+				}
 
-	if (E.rx >= (E.coloff + E.screencols))
-		E.coloff = (E.rx - (E.screencols + 1));	
-}
+				if (s != NULL)
+					break;
 
+				iov[cnt].iov_base = newline;
+				iov[cnt].iov_len = 1;
+				cnt++;
 
+				j++;
+				off = 0;
+			}
 
+			ssize_t w = writev(in[1], iov, cnt);
 
+			if (w == -1 && errno != EAGAIN)
+				wrow = from + n;
 
-/* Function that draws rows of tildes, like VIM does. */
-void editorDrawRows(struct abuf *ab)
-{
-	int y;
-	for (y = 0; y < E.screenrows; y++)
-	{
-		int filerow = (y + E.rowoff);
+			sent += (w > 0) ? w : 0;
 
-		if (filerow >= E.numrows) 
-		{
-			if (E.numrows == 0 && y == (E.screenrows / 3))
+			/* Move past what went out, which may end in the middle of a row. */
+			while (w > 0)
 			{
-				char welcome[80];
-				int welcomelen = snprintf(welcome, sizeof(welcome), 
-						"kilo editor -- version %s", KILO_VERSION);
-				if (welcomelen > E.screencols)
-					welcomelen = E.screencols;
-
-				/* Now we handle the condition if the terminal window is too small to */
-				/* Display the entire contents of the welcome message, by truncating  */
-				/* the message into a series of strings, thus making the message      */
-				/* viewable...														  */
-				int padding = (E.screencols - welcomelen) / 2;
+				int rest = E.buf.row[wrow].size + 1 - woff;
 
-				if (padding)
+				if (w >= rest)
 				{
-					abAppend(ab, "~", 1);
-					padding--;
+					w -= rest;
+					wrow++;
+					woff = 0;
 				}
 
-				while (padding--) 
-					abAppend(ab, " ", 1);
+				else
+				{
+					woff += w;
+					w = 0;
+				}
+			}
 
-				abAppend(ab, welcome, welcomelen);
-			}	
-		
-		else
-			abAppend(ab, "~", 1);
+			if (wrow == from + n)
+			{
+				close(in[1]);
+				in[1] = -1;
+			}
 		}
-		
-		else
+
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
 		{
-			int len = (E.row[filerow].rsize - E.coloff);
-			
-			if (len < 0)
-				len = 0;
-			
-			if (len > E.screencols) 
-				len = E.screencols;
-			
-			abAppend(ab, &E.row[filerow].render[E.coloff], len);
+			ssize_t r = read(out[0], chunk, KILO_READ_CHUNK);
+
+			if (r > 0)
+			{
+				editorFilterOutput(&rows, chunk, r, &open);
+				received += r;
+			}
+
+			else if (r == 0 || errno != EAGAIN)
+			{
+				close(out[0]);
+				out[0] = -1;
+			}
 		}
-		
-		/* Allows the terminal to clear the line that is outside of the render, as */
-		/* the user scrolls up and down a file. 								   */
-		abAppend(ab, "\x1b[K", 3);
 
-		abAppend(ab, "\r\n", 2);
-	}
-}
+		if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+		{
+			ssize_t r = read(err[0], chunk, KILO_READ_CHUNK);
 
+			/* Only the start of what the command complains about is kept. */
+			if (r > 0 && errlen < (int) sizeof(errmsg) - 1)
+			{
+				int take = (r < (ssize_t) sizeof(errmsg) - 1 - errlen) ? r : (int) sizeof(errmsg) - 1 - errlen;
 
+				memcpy(&errmsg[errlen], chunk, take);
+				errlen += take;
+			}
 
+			else if (r == 0 || (r == -1 && errno != EAGAIN))
+			{
+				close(err[0]);
+				err[0] = -1;
+			}
+		}
 
+		if (editorMillis() - last >= 1000)
+		{
+			last = editorMillis();
+			editorSetStatusMessage("Filtering: %lld MB in, %lld MB out (Ctrl-C to cancel)",
+								   sent >> 20, received >> 20);
+			editorRefreshScreen();
+		}
+	}
 
-/* Function responsible for drawing the status bar at the bottom of the editor. */
-void editorDrawStatusBar(struct abuf *ab)
-{
-	/* "\x1b[7m sets the text to inverted colour mode." */
-	abAppend(ab, "\x1b[7m", 4);
-	/* The char buffer "status" will be used to store the file's name.     */
-	/* The char buffer "rstatus" will be used to store the line number, at */
-	/* the right side of the status bar.								   */
-	char status[80];
-	char rstatus[80];
-	
-	/* Configure the length of the string, while checking if there is a specified name. */
-	/* If there is no name specified, len is equal to the length of "[No Name]"         */
-	int len = snprintf(status, sizeof(status), "%.20s - %d lines",
-				E.filename ? E.filename : "[No Name]", E.numrows);
+	int status;
 
-	/* The length of the string stored at the right side of the status bar is equal to the */
-	/* the length of the Cursor's y position and the Current row\line number.              */
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numrows);
+	if (in[1] != -1)
+		close(in[1]);
+	if (out[0] != -1)
+		close(out[0]);
+	if (err[0] != -1)
+		close(err[0]);
 
-	/* Check the bounds of the string. If it satisfies the bounds, append the file's name */
-	/* to the status bar.																  */
-	if (len > E.screenrows)
-		len = E.screenrows;
+	waitpid(pid, &status, 0);
+	sigaction(SIGPIPE, &old, NULL);
+	free(chunk);
 
-	abAppend(ab, status, len);
+	errmsg[errlen] = '\0';
+	errmsg[strcspn(errmsg, "\n")] = '\0';
 
-	/* Draw the status bar such that the current position is within the bounds of len. */
-	while (len < E.screencols)
+	/* Exit status 1 with nothing on stderr is how grep and friends say that */
+	/* nothing matched; anything else that is not 0 leaves the rows alone.   */
+	if (cancelled || !WIFEXITED(status) || (WEXITSTATUS(status) != 0 && (WEXITSTATUS(status) != 1 || errlen > 0)))
 	{
-		/* This IF-ELSE structure calculates the centered positioning of the string to be  */
-		/* displayed, relative to its designated area on the status bar. If it is centered */
-		/* the string is appended to the status bar.									   */
-		if ((E.screencols - len) == rlen)
-		{
-			abAppend(ab, rstatus, rlen);
-			break;
-		}
+		kiloBufferFree(&rows);
 
+		if (cancelled)
+			editorSetStatusMessage("Filter cancelled");
+		else if (!WIFEXITED(status))
+			editorSetStatusMessage("Filter killed by signal %d", WTERMSIG(status));
 		else
-		{
-			abAppend(ab, " ", 1);
-			len++;
-		}
+			editorSetStatusMessage("Filter failed (%d): %.50s", WEXITSTATUS(status), errmsg);
+
+		return;
 	}
 
-	/* This append function uses the "\x1b[m" which turns off inverted text mode. */
-	abAppend(ab, "\x1b[m", 3);
-	abAppend(ab, "\r\n", 2);
+	int m = rows.numrows;
+
+	editorUndoSeal();
+	editorUndoBeginBatch();
+	kiloBeginBatch(&E.buf);
+
+	kiloReplaceRows(&E.buf, from, n, &rows);
+
+	kiloEndBatch(&E.buf);
+	editorUndoEndBatch();
+
+	E.buf.cy = (from < E.buf.numrows) ? from : E.buf.numrows;
+	E.buf.cx = 0;
+
+	editorSetStatusMessage("Filtered %d rows into %d", n, m);
 }
 
 
 
 
-/* Function responsible for generating/displaying the message bar. */
-void editorDrawMessageBar(struct abuf *ab)
+/* Function that finds the rows from the mark to the cursor, both included, or */
+/* just the cursor's row when there is no mark. The file must not be empty.  */
+void editorMarkRange(int *from, int *to)
 {
-	/* No cursor on the message bar, thanks... */
-	abAppend(ab, "\x1b[K", 3);
+	int cy = (E.buf.cy < E.buf.numrows) ? E.buf.cy : E.buf.numrows - 1;
+	int mark = (E.mark != -1 && E.mark < E.buf.numrows) ? E.mark : cy;
 
-	/* msglen is equal to the length of the status message. */
-	int msglen = strlen(E.statusmsg);
+	*from = (mark < cy) ? mark : cy;
+	*to = (mark < cy) ? cy : mark;
+}
 
-	/* Check the bounds of the message. */
-	if (msglen > E.screencols)
-		msglen = E.screencols;
 
-	/* Center and append the status message and the time/date onto the message bar.*/
-	if (msglen && time(NULL) - E.statusmsg_time < 5)
-		abAppend(ab, E.statusmsg, msglen);
+
+
+/* Function responsible for asking for a command and filtering the rows from the */
+/* mark to the cursor through it, or every row when there is no mark.           */
+void editorFilter()
+{
+	int from = 0, to = E.buf.numrows - 1;
+
+	if (E.mark != -1)
+		editorMarkRange(&from, &to);
+
+	char *cmd = editorPrompt(E.mark != -1 ? "Filter rows through: " : "Filter file through: ");
+
+	if (cmd == NULL)
+		return;
+
+	editorFilterRows(cmd, from, to - from + 1);
+	E.mark = -1;
+
+	free(cmd);
 }
 
 
 
 
-/* Function that controlls the rendering and updating of screen content. */
-void editorRefreshScreen()
+/* Function responsible for copying the rows from the mark to the cursor, or the */
+/* cursor's row, to the clipboard, and taking them out of the file for a cut.    */
+/* The clipboard shares the rows' text rather than copying it, and cut rows      */
+/* hand theirs over, so a copy costs a pointer a row whatever its length.        */
+void editorCopy(int cut)
 {
-	/* Call the editorScroll function to see if the renderer must move the */
-	/* verticle frame up or down by 1 position. 						   */
-	editorScroll();
+	int from, to;
 
-	struct abuf ab = ABUF_INIT;
+	if (E.buf.numrows == 0)
+	{
+		editorSetStatusMessage("Nothing to copy");
+		return;
+	}
 
-	/* Gets rid of that annoying flickering. NOTE: "l" and "h" represent  */
-	/* "set mode" and "mode reset". The argument "?25" controlls whether  */
-	/* the cursor is shown or hidden.									  */
-	abAppend(&ab, "\x1b[?25h", 6);
-	/* Enables repositioning of the cursor. */
-	abAppend(&ab, "\x1b[H", 3);
+	editorMarkRange(&from, &to);
 
-	/* Draw the background "decorations" and then reposition the cursor. */
-	editorDrawRows(&ab);
-	/* Call the routine that draws the status bar. */
-	editorDrawStatusBar(&ab);
-	/* Call the routine that is responsible for displaying the message bar. */
-	editorDrawMessageBar(&ab);
+	int n = to - from + 1;
 
-	/* This segment of code will control the display of the cursors at n-position, */
-	/* As the program iterates, and the values of the cursor's x and y position    */
-	/* are updated. 															   */
-	char buf[32];
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-	abAppend(&ab, buf, strlen(buf));
+	kiloClipFree(E.clip);
+	E.clip = kiloCopyRows(&E.buf, from, n);
+	E.mark = -1;
 
-	abAppend(&ab, "\x1b[?25h", 6);
+	if (!cut)
+	{
+		editorSetStatusMessage("Copied %d rows", n);
+		return;
+	}
 
+	struct kiloBuffer none;
 
-	/* Reposition the cursor, and retire the current instance of the abuf. */
-	write(STDOUT_FILENO, ab.b, ab.len);
-	abFree(&ab);
-}
+	kiloBufferInit(&none, NULL);
 
+	editorUndoSeal();
+	editorUndoBeginBatch();
+	kiloBeginBatch(&E.buf);
 
+	kiloReplaceRows(&E.buf, from, n, &none);
 
+	kiloEndBatch(&E.buf);
+	editorUndoEndBatch();
 
+	E.buf.cy = (from < E.buf.numrows) ? from : E.buf.numrows;
+	E.buf.cx = 0;
 
-/* Function responsible for configuring the status bar message and time/date. */
-void editorSetStatusMessage(const char *fmt, ...)
+	editorSetStatusMessage("Cut %d rows", n);
+}
+
+
+
+
+/* Function responsible for inserting the rows of the clipboard above the cursor's */
+/* row. They share their text with the clipboard until they are edited, and are   */
+/* rendered and highlighted as they come into view, like those of an attached    */
+/* file, so a paste costs a row each however much text it holds.                 */
+void editorPaste()
 {
-	va_list ap;
-	va_start(ap, fmt);
+	if (E.clip == NULL || E.clip->numrows == 0)
+	{
+		editorSetStatusMessage("Nothing to paste");
+		return;
+	}
 
-	vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
-	
-	va_end(ap);
+	int at = (E.buf.cy < E.buf.numrows) ? E.buf.cy : E.buf.numrows;
+	int m = E.clip->numrows;
+	int j;
 
-	E.statusmsg_time = time(NULL);
+	editorUndoSeal();
+	editorUndoBeginBatch();
+	kiloBeginBatch(&E.buf);
+
+	kiloPasteRows(&E.buf, at, E.clip);
+
+	kiloEndBatch(&E.buf);
+	editorUndoEndBatch();
+
+	/* The rows after them may be coloured differently from here on. */
+	if (E.syntax)
+	{
+		for (j = at; j < at + m; j++)
+			editorRowSetReady(&E.buf.row[j], 0);
+
+		editorHighlightDefer(at + m);
+	}
+
+	E.buf.cy = at;
+	E.buf.cx = 0;
+
+	editorSetStatusMessage("Pasted %d rows", m);
 }
 
 
@@ -893,60 +5713,66 @@ void editorMoveCursor(int key)
 {
 	/* This ternary checks if the cursor is on an actuall line. If it is, then   */
 	/* the row variable will point to the erow that the cursor is on. Else check */
-	/* whether E.cx is to the left of the end of that line before we allow the   */
+	/* whether E.buf.cx is to the left of the end of that line before we allow the   */
 	/* cursor to move to the right. 											 */
-	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	erow *row = (E.buf.cy >= E.buf.numrows) ? NULL : &E.buf.row[E.buf.cy];
 
 	switch (key)
 	{
 	case ARROW_LEFT:
-		if (E.cx != 0)
-			E.cx--;
+		if (E.buf.cx != 0)
+			E.buf.cx = kiloRowPrevChar(row, E.buf.cx);
 
 		/* Allows the user to move to the end of the previous line by pressing */
-		/* ARROW_LEFT such that ARROW_LEFT is pressed when E.cx = 0.		   */
-		else if (E.cy > 0)
+		/* ARROW_LEFT such that ARROW_LEFT is pressed when E.buf.cx = 0.		   */
+		else if (E.buf.cy > 0)
 		{
-			E.cy--;
-			E.cx = E.row[E.cy].size;	
+			E.buf.cy = editorFoldRow(editorFoldIndex(E.buf.cy) - 1);
+			E.buf.cx = E.buf.row[E.buf.cy].size;	
 		}
 
 		break;
 	
 	case ARROW_RIGHT:
-		if (row && (E.cx < row->size))
-			E.cx++;
+		if (row && (E.buf.cx < row->size))
+			E.buf.cx = kiloRowNextChar(row, E.buf.cx);
 
 		/* Allows the user to move to the end of the next line by pressing     */
-		/* ARROW_RIGHT such that ARROW_RIGHT is pressed when E.cx = the length */
+		/* ARROW_RIGHT such that ARROW_RIGHT is pressed when E.buf.cx = the length */
 		/* of the row; when the cursor is at the end of the current row.       */
-		else if (row && (E.cx == row->size))
+		else if (row && (E.buf.cx == row->size))
 		{
-			E.cy++;
-			E.cx = 0;
+			E.buf.cy = editorFoldRow(editorFoldIndex(E.buf.cy) + 1);
+			E.buf.cx = 0;
 		}
 
 		break;
 	
+	/* Up and down step over folded rows. */
 	case ARROW_UP:
-		if (E.cy != 0)
-			E.cy--;
+		if (E.buf.cy != 0)
+			E.buf.cy = editorFoldRow(editorFoldIndex(E.buf.cy) - 1);
 		break;
 	
 	case ARROW_DOWN:
-		if (E.cy < E.numrows)
-			E.cy++;
+		if (E.buf.cy < E.buf.numrows)
+			E.buf.cy = editorFoldRow(editorFoldIndex(E.buf.cy) + 1);
 		break;
 	}
 
 	/* This code ensures that the cursor is snapped to the end of a line. */
-	row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+	row = (E.buf.cy >= E.buf.numrows) ? NULL : &E.buf.row[E.buf.cy];
 	int rowlen = row ? row->size : 0;
 
-	if (E.cx > rowlen)
+	if (E.buf.cx > rowlen)
 	{
-		E.cx = rowlen;
+		E.buf.cx = rowlen;
 	}
+
+	/* Rows above and below may have a multi-byte character where the cursor */
+	/* lands; it goes to the start of that character.                        */
+	if (row)
+		E.buf.cx = kiloRowSnap(row, E.buf.cx);
 }
 
 
@@ -958,17 +5784,29 @@ void editorProcessKeypress()
 {
 	int c = editorReadKey();
 
+	long long t0 = TRACE_BEGIN();
+
+	/* The hex view has keys of its own; those it leaves are the same in both. */
+	if (E.hex.on && editorHexKey(c))
+	{
+		TRACE_END(TRACE_EDIT, t0);
+		return;
+	}
+
 	switch (c)
 	{
 		case '\r':
-		/* 	 TODO	*/
-		break;
+			kiloInsertText(&E.buf, E.buf.cy, E.buf.cx, "\n", 1, &E.buf.cy, &E.buf.cx);
+			break;
 
 		/* Code for the "Quit" key-binding. */
 		case CTRL_KEY('q'):
 			write(STDOUT_FILENO, "\x1b[2J", 4);
 			write(STDOUT_FILENO, "\x1b[H", 3);
 
+			/* Quitting on purpose throws the unsaved edits away, journals included. */
+			editorFilesQuit();
+
 			exit(0);
 			break;
 
@@ -977,20 +5815,35 @@ void editorProcessKeypress()
 			editorSave();
 			break;
 
+		/* Code for the "Undo" and "Redo" key-bindings. */
+		case CTRL_KEY('z'):
+			editorUndo();
+			break;
+
+		case CTRL_KEY('y'):
+			editorRedo();
+			break;
+
 		case HOME_KEY:
-			E.cx = 0;
+			editorUndoSeal();
+			E.buf.cx = 0;
 			break;
 
 		case END_KEY:
-			if (E.cy < E.numrows)
-				E.cx = E.row[E.cy].size;
+			editorUndoSeal();
+			if (E.buf.cy < E.buf.numrows)
+				E.buf.cx = E.buf.row[E.buf.cy].size;
 
 			break;
 
 		case BACKSPACE:
 		case CTRL_KEY('h'):
 		case DEL_KEY:
-			/* 	 TODO	*/
+			/* The delete key removes the character under the cursor instead. */
+			if (c == DEL_KEY)
+				editorMoveCursor(ARROW_RIGHT);
+
+			kiloDelChar(&E.buf);
 			break;
 
 		/* *NOTE: THERE IS A BUG HERE* */
@@ -998,18 +5851,20 @@ void editorProcessKeypress()
 		case PAGE_DOWN:
 			{
 				if (c == PAGE_UP)
-					E.cy = E.rowoff;
+					E.buf.cy = E.rowoff;
 
 				else if (c == PAGE_DOWN)
 				{
-					E.cy = (E.rowoff + E.screenrows - 1);
+					E.buf.cy = editorFoldRow(editorFoldIndex(E.rowoff) + E.screenrows - 1);
 
-					if (E.cy > E.numrows)
-						E.cy = E.numrows;
+					if (E.buf.cy > E.buf.numrows)
+						E.buf.cy = E.buf.numrows;
 				}
 
 				int times = E.screenrows;
 
+				editorUndoSeal();
+
 				while (times--)
 					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
 			}
@@ -1020,6 +5875,7 @@ void editorProcessKeypress()
 		case ARROW_DOWN:
 		case ARROW_LEFT:
 		case ARROW_RIGHT:
+			editorUndoSeal();
 			editorMoveCursor(c);
 			break;
 
@@ -1027,11 +5883,57 @@ void editorProcessKeypress()
 		case 'x1b':
 			break;
 
+		/* Code for the "Next file" and "Previous file" key-bindings. */
+		case CTRL_KEY('n'):
+			editorFilesSwitch(E.files.cur + 1);
+			break;
+
+		case CTRL_KEY('p'):
+			editorFilesSwitch(E.files.cur - 1);
+			break;
+
+		/* Code for the "Mark" and "Filter" key-bindings. */
+		case CTRL_KEY('b'):
+			E.mark = (E.mark == -1 && E.buf.cy < E.buf.numrows) ? E.buf.cy : -1;
+			editorSetStatusMessage(E.mark == -1 ? "Mark cleared" : "Mark set");
+			break;
+
+		case CTRL_KEY('r'):
+			editorFilter();
+			break;
+
+		/* Code for the "Copy", "Cut" and "Paste" key-bindings. */
+		case CTRL_KEY('c'):
+		case CTRL_KEY('x'):
+			editorCopy(c == CTRL_KEY('x'));
+			break;
+
+		case CTRL_KEY('v'):
+			editorPaste();
+			break;
+
+		/* Code for the "Fold" key-binding. */
+		case CTRL_KEY('f'):
+			editorFoldToggle();
+			break;
+
+		/* Code for the memory report key-binding. */
+		case CTRL_KEY('g'):
+			editorMemReport();
+			break;
+
+		/* Code for the frame timing overlay key-binding. */
+		case CTRL_KEY('t'):
+			editorTraceToggleOverlay();
+			break;
+
 		/* The default case will always be to insert characters. */
 		default:
-			editorInsertChar(c);
+			kiloInsertChar(&E.buf, c);
 			break;
 	}
+
+	TRACE_END(TRACE_EDIT, t0);
 }
 
 
@@ -1041,18 +5943,54 @@ void editorProcessKeypress()
 /* Function responsible for initializing our editor. */
 void initEditor()
 {
-	/* Set the initial values of the cursor's x and y position. */
-	E.cx = 0;
-	E.cy = 0;
+	/* The buffer starts out empty, with the cursor at the top left. */
+	kiloBufferInit(&E.buf, &editorBufferHooks);
 	E.rx = 0;
 	E.rowoff = 0;
 	E.coloff = 0;
-	E.numrows = 0;
-	E.row = NULL;
 	E.filename = NULL;
+	E.syntax = NULL;
+	E.gzip = 0;
+	E.disk_size = -1;
+	E.disk_mtime = -1;
+	E.shared = NULL;
+	E.shared_len = 0;
+	E.mark = -1;
+	E.clip = NULL;
+	E.hexall = 0;
+	memset(&E.hex, 0, sizeof(E.hex));
+	E.hex.fd = -1;
+	E.fold.b1 = NULL;
+	E.fold.b2 = NULL;
+	E.fold.n = 0;
+	E.fold.cap = 0;
+	E.fold.count = 0;
+	E.fold.stale = 1;
+	E.journal.fd = -1;
+	E.journal.path = NULL;
+	E.journal.buf = NULL;
+	E.journal.len = 0;
+	E.journal.cap = 0;
+	E.journal.last = -1;
+	E.journal.replaying = 0;
+	E.journal.last_edit = 0;
+	E.journal.last_sync = 0;
 	E.statusmsg[0] = '\0';
 	E.statusmsg_time = 0;
 
+	editorUndoInit();
+	editorTraceInit();
+	memset(&E.mem, 0, sizeof(E.mem));
+	editorFilesInit();
+
+	E.hl.nthreads = 0;
+	E.hl.issued = 0;
+	atomic_init(&E.hl.claimed, 0);
+	E.hl.epoch = 0;
+	E.hl.scan = 0;
+	E.hl.unready = 0;
+	E.hl.defer = 0;
+
 	if (getWindowSize(&E.screenrows, &E.screencols) == -1)
 		terminate("getWindowSize");
 
@@ -1072,16 +6010,39 @@ void initEditor()
 /* UNDERRATED LOL. No but seriously... this is the main function if you couldn't see already. */
 int main(int argc, char *argv[])
 {
+	/* "kilo --server" runs the session server instead of the editor. */
+	if (argc >= 2 && !strcmp(argv[1], "--server"))
+		return editorServe();
+
 	/* Enable raw-text mode at the begining of the application. */
 	enableRawMode();
 	/* Call the editor initialization function. */
 	initEditor();
+
+	/* "kilo --hex" opens the files that follow in the hex view. */
+	if (argc >= 2 && !strcmp(argv[1], "--hex"))
+	{
+		E.hexall = 1;
+		argv++;
+		argc--;
+	}
 	/* File I/O function. */
+	/* Set the initial status message.*/
+	editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-Z = undo | Ctrl-Y = redo");
+
 	if (argc >= 2)
+	{
 		editorOpen(argv[1]);
+		editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-Z = undo | Ctrl-Y = redo");
 
-	/* Set the initial status message.*/
-	editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit");
+		/* Pick up the edits of a session that did not get to save or quit. */
+		editorJournalInit();
+		editorJournalRecover();
+	}
+
+	/* The other files are only read once they are switched to. */
+	for (int j = 2; j < argc; j++)
+		editorFilesAdd(argv[j]);
 
 	/* The main program loop will iterate indefinately, until read() returns 0, */
 	/* OR until the user enters the character 'Ctrl-q'.							*/
@@ -0,0 +1,2412 @@
+
+
+
+
+
+/* File:	 kilo_core.c														*/
+/* ====[DESCRIPTION]=========================================================== */
+/* The editor core: rows, cursor and text primitives, see kilo_core.h. Every	*/
+/* function takes the buffer it works on; the only global state is a table of	*/
+/* character widths that is filled in once and only read after that.			*/
+/* ============================================================================ */
+
+
+
+
+
+/* ====[INCLUDES]========================================================================================================= */
+
+
+
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+
+
+#include "kilo_core.h"
+
+/* Standard C Library file that will be used for error checking and memory management. */
+#include <stdlib.h>
+/* Standard C Library file that provides functions for string manipulation such as memcpy(). */
+#include <string.h>
+/* Standard C Library file that provides INT_MAX. */
+#include <limits.h>
+/* glibc's malloc_usable_size(), used to account for what allocations really cost. */
+#include <malloc.h>
+/* Standard C Library file that provides uint64_t. */
+#include <stdint.h>
+#ifdef __SSE2__
+/* SSE2 intrinsics, used to find rows that are all ASCII 64 bytes at a time. */
+#include <emmintrin.h>
+#endif
+
+
+
+
+
+/* ====[PROTOTYPES]======================================================================================================= */
+static void kiloFreeRow(struct kiloBuffer *b, erow *row);
+static void kiloWidthInit(void);
+static int kiloRowAscii(erow *row);
+
+
+
+
+
+/* ====[BUFFER]=========================================================================================================== */
+
+
+
+
+
+/* Function responsible for setting up an empty buffer. "hooks" may be NULL. */
+void kiloBufferInit(struct kiloBuffer *b, const struct kiloHooks *hooks)
+{
+	memset(b, 0, sizeof(*b));
+
+	b->shift_at = -1;
+
+	kiloWidthInit();
+
+	if (hooks)
+		b->hooks = *hooks;
+}
+
+
+
+
+/* Function responsible for releasing every row of a buffer, leaving it empty. */
+/* The hooks and the user pointer are kept, so the buffer can be used again.   */
+void kiloBufferFree(struct kiloBuffer *b)
+{
+	struct kiloHooks hooks = b->hooks;
+	void *user = b->user;
+	int j;
+
+	for (j = 0; j < b->numrows; j++)
+		kiloFreeRow(b, &b->row[j]);
+
+	free(b->row);
+	free(b->dirtyrows);
+
+	kiloBufferInit(b, &hooks);
+	b->user = user;
+}
+
+
+
+
+/* Function that tells how much memory an allocation really takes: what malloc() */
+/* made usable plus its chunk header.                                            */
+size_t kiloMemSize(void *p)
+{
+	return p ? malloc_usable_size(p) + sizeof(size_t) : 0;
+}
+
+
+
+
+/* Function responsible for moving one of the buffer's memory counters from the */
+/* old to the new size of an allocation.                                        */
+static void kiloMemAdjust(struct kiloBuffer *b, size_t *counter, size_t oldsize, size_t newsize)
+{
+	*counter += newsize - oldsize;
+
+	if (oldsize == 0 && newsize != 0)
+		b->nalloc++;
+	else if (oldsize != 0 && newsize == 0)
+		b->nalloc--;
+}
+
+
+
+
+
+/* ====[ROPES]============================================================================================================ */
+
+
+
+
+
+/* Structure that holds one chunk of a long row. Every chunk has room for      */
+/* KILO_ROPE_CHUNK * 2 bytes, so that typing into it never moves other chunks. */
+struct kiloChunk
+{
+	char *data;
+	int len;
+	int width;
+};
+
+/* Structure that holds a long row as an array of chunks, with two Fenwick trees */
+/* (1-based) over the chunks' lengths and rendered widths: the chunk holding a  */
+/* byte or a screen column is found in O(log n), and an edit within one chunk   */
+/* updates both in O(log n) as well.                                            */
+struct kiloRope
+{
+	struct kiloChunk *chunks;
+	int n;
+	int cap;
+	int *bytes;
+	int *widths;
+	/* Highest power of two not above n, where the descents start. */
+	int top;
+};
+
+
+
+
+/* Function that returns how many columns a piece of a long row takes on screen. */
+static int kiloTextWidth(const char *s, int len)
+{
+	int width = len;
+	int j;
+
+	for (j = 0; j < len; j++)
+		if (s[j] == '\t')
+			width += KILO_TAB_STOP - 1;
+
+	return width;
+}
+
+
+
+
+/* Function responsible for making room for at least "n" chunks in a rope. */
+static void kiloRopeReserve(struct kiloBuffer *b, struct kiloRope *r, int n)
+{
+	if (n <= r->cap)
+		return;
+
+	size_t oldsize = kiloMemSize(r->chunks) + kiloMemSize(r->bytes) + kiloMemSize(r->widths);
+
+	r->cap = (n > r->cap * 2) ? n : r->cap * 2;
+	r->chunks = realloc(r->chunks, sizeof(struct kiloChunk) * r->cap);
+	r->bytes = realloc(r->bytes, sizeof(int) * (r->cap + 1));
+	r->widths = realloc(r->widths, sizeof(int) * (r->cap + 1));
+
+	kiloMemAdjust(b, &b->mem_chars, oldsize,
+				  kiloMemSize(r->chunks) + kiloMemSize(r->bytes) + kiloMemSize(r->widths));
+}
+
+
+
+
+/* Function responsible for bringing the Fenwick trees up to date after chunks */
+/* from index "from" on were added, removed or changed. The entries before it  */
+/* still hold, so this costs O(n - from + log n) rather than a full rebuild.   */
+static void kiloRopeRebuild(struct kiloRope *r, int from)
+{
+	int i;
+
+	for (r->top = 1; r->top * 2 <= r->n; r->top *= 2)
+		;
+
+	for (i = from + 1; i <= r->n; i++)
+	{
+		r->bytes[i] = r->chunks[i - 1].len;
+		r->widths[i] = r->chunks[i - 1].width;
+	}
+
+	/* The entries that cover the unchanged chunks are added to their parents first. */
+	for (i = from; i > 0; i -= i & -i)
+		if (i + (i & -i) <= r->n)
+		{
+			r->bytes[i + (i & -i)] += r->bytes[i];
+			r->widths[i + (i & -i)] += r->widths[i];
+		}
+
+	for (i = from + 1; i <= r->n; i++)
+		if (i + (i & -i) <= r->n)
+		{
+			r->bytes[i + (i & -i)] += r->bytes[i];
+			r->widths[i + (i & -i)] += r->widths[i];
+		}
+}
+
+
+
+
+/* Function responsible for adding to the length and width of chunk "i". */
+static void kiloRopeAdd(struct kiloRope *r, int i, int dlen, int dwidth)
+{
+	for (i++; i <= r->n; i += i & -i)
+	{
+		r->bytes[i] += dlen;
+		r->widths[i] += dwidth;
+	}
+}
+
+
+
+
+/* Function that sums one of the trees over the first "i" chunks. */
+static int kiloRopePrefix(const int *tree, int i)
+{
+	int sum = 0;
+
+	for (; i > 0; i -= i & -i)
+		sum += tree[i];
+
+	return sum;
+}
+
+
+
+
+/* Function that finds the chunk holding byte (or column) "target" of one of the */
+/* trees, by walking down it. The offset into that chunk is stored in *rem. Past */
+/* the end, the chunk count is returned.                                         */
+static int kiloRopeFind(const struct kiloRope *r, const int *tree, int target, int *rem)
+{
+	int pos = 0;
+	int step;
+
+	for (step = r->top; step > 0; step >>= 1)
+		if (pos + step <= r->n && tree[pos + step] <= target)
+		{
+			pos += step;
+			target -= tree[pos];
+		}
+
+	*rem = target;
+	return pos;
+}
+
+
+
+
+/* Function responsible for inserting "count" empty chunks at index "at". The */
+/* caller fills them and rebuilds the trees.                                  */
+static void kiloRopeInsertChunks(struct kiloBuffer *b, struct kiloRope *r, int at, int count)
+{
+	int j;
+
+	kiloRopeReserve(b, r, r->n + count);
+	memmove(&r->chunks[at + count], &r->chunks[at], sizeof(struct kiloChunk) * (r->n - at));
+
+	for (j = at; j < at + count; j++)
+	{
+		r->chunks[j].data = malloc(KILO_ROPE_CHUNK * 2);
+		r->chunks[j].len = 0;
+		r->chunks[j].width = 0;
+
+		kiloMemAdjust(b, &b->mem_chars, 0, kiloMemSize(r->chunks[j].data));
+	}
+
+	r->n += count;
+}
+
+
+
+
+/* Function responsible for releasing a chunk's memory. */
+static void kiloRopeFreeChunk(struct kiloBuffer *b, struct kiloChunk *c)
+{
+	kiloMemAdjust(b, &b->mem_chars, kiloMemSize(c->data), 0);
+	free(c->data);
+}
+
+
+
+
+/* Function responsible for creating an empty rope. */
+static struct kiloRope *kiloRopeNew(struct kiloBuffer *b)
+{
+	struct kiloRope *r = calloc(1, sizeof(struct kiloRope));
+
+	kiloMemAdjust(b, &b->mem_chars, 0, kiloMemSize(r));
+
+	return r;
+}
+
+
+
+
+/* Function responsible for releasing a rope and all of its chunks. */
+static void kiloRopeFree(struct kiloBuffer *b, struct kiloRope *r)
+{
+	int j;
+
+	for (j = 0; j < r->n; j++)
+		kiloRopeFreeChunk(b, &r->chunks[j]);
+
+	kiloMemAdjust(b, &b->mem_chars, kiloMemSize(r->chunks) + kiloMemSize(r->bytes) +
+				  kiloMemSize(r->widths) + kiloMemSize(r), 0);
+
+	free(r->chunks);
+	free(r->bytes);
+	free(r->widths);
+	free(r);
+}
+
+
+
+
+/* Function that tells how much of the buffer's memory a rope takes, and in how */
+/* many allocations, the same as kiloRopeFree() gives back.                     */
+static size_t kiloRopeMem(const struct kiloRope *r, int *count)
+{
+	size_t mem = kiloMemSize(r->chunks) + kiloMemSize(r->bytes) + kiloMemSize(r->widths) +
+				 kiloMemSize((void *) r);
+	int j;
+
+	for (j = 0; j < r->n; j++)
+		mem += kiloMemSize(r->chunks[j].data);
+
+	*count = r->n + 1;
+	return mem;
+}
+
+
+
+
+/* Function responsible for creating a rope holding a copy of every chunk of "r". */
+static struct kiloRope *kiloRopeClone(struct kiloBuffer *b, const struct kiloRope *r)
+{
+	struct kiloRope *t = kiloRopeNew(b);
+	int j;
+
+	kiloRopeInsertChunks(b, t, 0, r->n);
+
+	for (j = 0; j < r->n; j++)
+	{
+		memcpy(t->chunks[j].data, r->chunks[j].data, r->chunks[j].len);
+		t->chunks[j].len = r->chunks[j].len;
+		t->chunks[j].width = r->chunks[j].width;
+	}
+
+	kiloRopeRebuild(t, 0);
+	return t;
+}
+
+
+
+
+/* Function responsible for dropping empty chunks and merging neighbours that fit */
+/* in one chunk together, from chunk "from" on, then rebuilding the trees.       */
+static void kiloRopeCompact(struct kiloBuffer *b, struct kiloRope *r, int from)
+{
+	int out, j;
+
+	if (from > 0)
+		from--;
+
+	for (out = j = from; j < r->n; j++)
+	{
+		struct kiloChunk *c = &r->chunks[j];
+		struct kiloChunk *prev = (out > 0) ? &r->chunks[out - 1] : NULL;
+
+		if (prev && out > from && prev->len + c->len <= KILO_ROPE_CHUNK)
+		{
+			memcpy(&prev->data[prev->len], c->data, c->len);
+			prev->len += c->len;
+			prev->width += c->width;
+			kiloRopeFreeChunk(b, c);
+		}
+
+		else if (c->len == 0)
+			kiloRopeFreeChunk(b, c);
+
+		else
+			r->chunks[out++] = *c;
+	}
+
+	r->n = out;
+	kiloRopeRebuild(r, from);
+}
+
+
+
+
+/* Function responsible for copying "n" bytes into a chunk from "s", and from "t" */
+/* once "s" runs out; both are advanced past what was taken.                     */
+static void kiloRopeFill(struct kiloChunk *c, int n, const char **s, int *slen, const char **t, int *tlen)
+{
+	int take = (n < *slen) ? n : *slen;
+
+	memcpy(&c->data[c->len], *s, take);
+	*s += take;
+	*slen -= take;
+	c->len += take;
+	n -= take;
+
+	memcpy(&c->data[c->len], *t, n);
+	*t += n;
+	*tlen -= n;
+	c->len += n;
+
+	c->width = kiloTextWidth(c->data, c->len);
+}
+
+
+
+
+/* Function responsible for creating a rope holding a copy of "len" bytes of "s". */
+static struct kiloRope *kiloRopeFromText(struct kiloBuffer *b, const char *s, int len)
+{
+	struct kiloRope *r = kiloRopeNew(b);
+	int count = (len + KILO_ROPE_CHUNK - 1) / KILO_ROPE_CHUNK;
+	const char *none = "";
+	int nonelen = 0;
+	int j;
+
+	kiloRopeInsertChunks(b, r, 0, count);
+
+	for (j = 0; j < count; j++)
+		kiloRopeFill(&r->chunks[j], (len < KILO_ROPE_CHUNK) ? len : KILO_ROPE_CHUNK,
+					 &s, &len, &none, &nonelen);
+
+	kiloRopeRebuild(r, 0);
+	return r;
+}
+
+
+
+
+/* Function responsible for inserting "len" bytes at byte "pos" of a rope. Text */
+/* that fits in the chunk it lands in costs O(chunk + log n); otherwise it and  */
+/* the rest of that chunk are spread over new chunks following it.              */
+static void kiloRopeInsert(struct kiloBuffer *b, struct kiloRope *r, int pos, const char *s, int len)
+{
+	int rem, i;
+
+	if (len <= 0)
+		return;
+
+	if (r->n == 0)
+	{
+		kiloRopeInsertChunks(b, r, 0, 1);
+		kiloRopeRebuild(r, 0);
+	}
+
+	i = kiloRopeFind(r, r->bytes, pos, &rem);
+	if (i == r->n)
+	{
+		i = r->n - 1;
+		rem = r->chunks[i].len;
+	}
+
+	struct kiloChunk *c = &r->chunks[i];
+
+	if (c->len + len <= KILO_ROPE_CHUNK * 2)
+	{
+		int width = kiloTextWidth(s, len);
+
+		memmove(&c->data[rem + len], &c->data[rem], c->len - rem);
+		memcpy(&c->data[rem], s, len);
+		c->len += len;
+		c->width += width;
+
+		kiloRopeAdd(r, i, len, width);
+		return;
+	}
+
+	int taillen = c->len - rem;
+	char *tail = malloc(taillen + 1);
+	const char *t = tail;
+
+	memcpy(tail, &c->data[rem], taillen);
+	c->len = rem;
+
+	/* Top the chunk up to KILO_ROPE_CHUNK bytes, then add as many as needed. */
+	int first = (rem < KILO_ROPE_CHUNK) ? KILO_ROPE_CHUNK - rem : 0;
+	int total = len + taillen;
+	int j;
+
+	if (first > total)
+		first = total;
+
+	int count = (total - first + KILO_ROPE_CHUNK - 1) / KILO_ROPE_CHUNK;
+
+	kiloRopeInsertChunks(b, r, i + 1, count);
+	kiloRopeFill(&r->chunks[i], first, &s, &len, &t, &taillen);
+
+	for (j = i + 1; j <= i + count; j++)
+		kiloRopeFill(&r->chunks[j], (len + taillen < KILO_ROPE_CHUNK) ? len + taillen : KILO_ROPE_CHUNK,
+					 &s, &len, &t, &taillen);
+
+	free(tail);
+	kiloRopeRebuild(r, i);
+}
+
+
+
+
+/* Function responsible for deleting "len" bytes from byte "pos" of a rope. */
+static void kiloRopeDelete(struct kiloBuffer *b, struct kiloRope *r, int pos, int len)
+{
+	int rem, i;
+
+	if (len <= 0 || r->n == 0)
+		return;
+
+	i = kiloRopeFind(r, r->bytes, pos, &rem);
+	if (i == r->n)
+		return;
+
+	struct kiloChunk *c = &r->chunks[i];
+
+	if (rem + len <= c->len && len < c->len)
+	{
+		/* The common case of a deletion that stays within one chunk. */
+		int width = kiloTextWidth(&c->data[rem], len);
+
+		memmove(&c->data[rem], &c->data[rem + len], c->len - (rem + len));
+		c->len -= len;
+		c->width -= width;
+
+		kiloRopeAdd(r, i, -len, -width);
+		return;
+	}
+
+	int j;
+
+	for (j = i; len > 0 && j < r->n; j++)
+	{
+		c = &r->chunks[j];
+
+		int take = (c->len - rem < len) ? c->len - rem : len;
+
+		c->width -= kiloTextWidth(&c->data[rem], take);
+		memmove(&c->data[rem], &c->data[rem + take], c->len - (rem + take));
+		c->len -= take;
+
+		len -= take;
+		rem = 0;
+	}
+
+	kiloRopeCompact(b, r, i);
+}
+
+
+
+
+/* Function responsible for cutting a rope in two at byte "pos". The rope keeps  */
+/* what comes before it; a new rope with the rest is returned. The chunks after  */
+/* the cut move over whole, so this costs O(n) pointer moves and no text copies */
+/* beyond one chunk.                                                            */
+static struct kiloRope *kiloRopeSplit(struct kiloBuffer *b, struct kiloRope *r, int pos)
+{
+	struct kiloRope *t = kiloRopeNew(b);
+	int rem, i;
+
+	if (r->n == 0 || (i = kiloRopeFind(r, r->bytes, pos, &rem)) == r->n)
+		return t;
+
+	struct kiloChunk *c = &r->chunks[i];
+	int moved = r->n - (i + 1);
+
+	kiloRopeInsertChunks(b, t, 0, 1);
+	kiloRopeReserve(b, t, 1 + moved);
+
+	memcpy(t->chunks[0].data, &c->data[rem], c->len - rem);
+	t->chunks[0].len = c->len - rem;
+	t->chunks[0].width = kiloTextWidth(t->chunks[0].data, t->chunks[0].len);
+
+	c->len = rem;
+	c->width = kiloTextWidth(c->data, rem);
+
+	memcpy(&t->chunks[1], &r->chunks[i + 1], sizeof(struct kiloChunk) * moved);
+	t->n = 1 + moved;
+	r->n = i + 1;
+
+	kiloRopeCompact(b, r, i);
+	kiloRopeCompact(b, t, 0);
+
+	return t;
+}
+
+
+
+
+/* Function responsible for moving the chunks of rope "t" to the end of rope "r". */
+/* "t" is released.                                                              */
+static void kiloRopeAppend(struct kiloBuffer *b, struct kiloRope *r, struct kiloRope *t)
+{
+	int from = r->n;
+
+	if (t->n > 0)
+	{
+		kiloRopeReserve(b, r, r->n + t->n);
+		memcpy(&r->chunks[r->n], t->chunks, sizeof(struct kiloChunk) * t->n);
+		r->n += t->n;
+		t->n = 0;
+	}
+
+	kiloRopeFree(b, t);
+	kiloRopeCompact(b, r, from);
+}
+
+
+
+
+/* Function responsible for copying "len" bytes from byte "pos" of a rope. */
+static void kiloRopeRead(const struct kiloRope *r, int pos, int len, char *dst)
+{
+	int rem, i;
+
+	if (len <= 0)
+		return;
+
+	for (i = kiloRopeFind(r, r->bytes, pos, &rem); len > 0 && i < r->n; i++)
+	{
+		int n = r->chunks[i].len - rem;
+
+		if (n > len)
+			n = len;
+
+		memcpy(dst, &r->chunks[i].data[rem], n);
+		dst += n;
+		len -= n;
+		rem = 0;
+	}
+}
+
+
+
+
+/* Function responsible for rendering "cols" screen columns of a rope, starting */
+/* at column "col", into "dst". Returns the number of bytes written.            */
+static int kiloRopeWindow(const struct kiloRope *r, int col, int cols, char *dst)
+{
+	int out = 0;
+	int wrem, i;
+
+	for (i = kiloRopeFind(r, r->widths, col, &wrem); i < r->n && out < cols; i++)
+	{
+		const struct kiloChunk *c = &r->chunks[i];
+		int j;
+
+		for (j = 0; j < c->len && out < cols; j++)
+		{
+			int width = (c->data[j] == '\t') ? KILO_TAB_STOP : 1;
+
+			/* Skip what is left of the columns before the window; a tab may be cut. */
+			if (wrem >= width)
+			{
+				wrem -= width;
+				continue;
+			}
+
+			if (c->data[j] == '\t')
+				for (width -= wrem; width > 0 && out < cols; width--)
+					dst[out++] = ' ';
+			else
+				dst[out++] = c->data[j];
+
+			wrem = 0;
+		}
+	}
+
+	return out;
+}
+
+
+
+
+
+/* ====[UTF-8]============================================================================================================ */
+
+
+
+
+
+/* Ranges of code points that take no column of their own: combining marks,   */
+/* zero width spaces and joiners, direction marks and variation selectors.    */
+static const int kiloZeroWidth[][2] =
+{
+	{0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+	{0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+	{0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+	{0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711}, {0x0730, 0x074A},
+	{0x07A6, 0x07B0}, {0x0900, 0x0902}, {0x093C, 0x093C}, {0x0941, 0x0948},
+	{0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981},
+	{0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD}, {0x0E31, 0x0E31},
+	{0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC},
+	{0x0EC8, 0x0ECD}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F},
+	{0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0x302A, 0x302D},
+	{0x3099, 0x309A}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}
+};
+
+/* Ranges of code points that take two columns: East Asian wide and full width */
+/* characters, and the emoji terminals draw wide.                              */
+static const int kiloWide[][2] =
+{
+	{0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+	{0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+	{0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+	{0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+	{0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+	{0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+	{0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+	{0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+	{0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+	{0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+	{0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+	{0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x1F300, 0x1F64F},
+	{0x1F680, 0x1F6FF}, {0x1F900, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD},
+	{0x30000, 0x3FFFD}
+};
+
+/* Column width of every code point of the Basic Multilingual Plane, looked up */
+/* once from the tables above so that measuring a character is a single load.  */
+/* It is filled by the first kiloBufferInit() and only read after that.        */
+static unsigned char kiloWidths[0x10000];
+static int kiloWidthsReady;
+
+
+
+
+
+/* Function responsible for filling in the column width table. */
+static void kiloWidthInit(void)
+{
+	size_t j;
+	int cp;
+
+	if (kiloWidthsReady)
+		return;
+
+	memset(kiloWidths, 1, sizeof(kiloWidths));
+
+	for (j = 0; j < sizeof(kiloZeroWidth) / sizeof(kiloZeroWidth[0]); j++)
+		for (cp = kiloZeroWidth[j][0]; cp <= kiloZeroWidth[j][1]; cp++)
+			kiloWidths[cp] = 0;
+
+	for (j = 0; j < sizeof(kiloWide) / sizeof(kiloWide[0]) && kiloWide[j][0] < 0x10000; j++)
+		for (cp = kiloWide[j][0]; cp <= kiloWide[j][1]; cp++)
+			kiloWidths[cp] = 2;
+
+	kiloWidthsReady = 1;
+}
+
+
+
+
+/* Function that tells whether "len" bytes are all ASCII. With SSE2, where the */
+/* compiler has it, it tests 64 bytes (four vectors OR'd together) at a time,  */
+/* then sixteen; otherwise eight at a time.                                    */
+int kiloIsAscii(const char *s, int len)
+{
+	int j = 0;
+
+#ifdef __SSE2__
+	for (; j + 64 <= len; j += 64)
+	{
+		__m128i v = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *) &s[j]),
+			_mm_loadu_si128((const __m128i *) &s[j + 16])),
+			_mm_or_si128(_mm_loadu_si128((const __m128i *) &s[j + 32]),
+			_mm_loadu_si128((const __m128i *) &s[j + 48])));
+
+		if (_mm_movemask_epi8(v))
+			return 0;
+	}
+
+	for (; j + 16 <= len; j += 16)
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) &s[j])))
+			return 0;
+#else
+	for (; j + 8 <= len; j += 8)
+	{
+		uint64_t w;
+
+		memcpy(&w, &s[j], 8);
+
+		if (w & 0x8080808080808080ULL)
+			return 0;
+	}
+#endif
+
+	for (; j < len; j++)
+		if (s[j] & 0x80)
+			return 0;
+
+	return 1;
+}
+
+
+
+
+/* Function responsible for decoding the UTF-8 sequence at "s", of at most "len" */
+/* bytes. Returns its length and stores the code point in *cp; a byte that does  */
+/* not start a valid sequence is one byte long with *cp set to -1.               */
+int kiloUtf8Decode(const char *s, int len, int *cp)
+{
+	unsigned char c = s[0];
+	int n, min, j;
+
+	if (c < 0x80)
+	{
+		*cp = c;
+		return 1;
+	}
+
+	if ((c & 0xE0) == 0xC0)
+	{
+		n = 2;
+		min = 0x80;
+		*cp = c & 0x1F;
+	}
+
+	else if ((c & 0xF0) == 0xE0)
+	{
+		n = 3;
+		min = 0x800;
+		*cp = c & 0x0F;
+	}
+
+	else if ((c & 0xF8) == 0xF0)
+	{
+		n = 4;
+		min = 0x10000;
+		*cp = c & 0x07;
+	}
+
+	else
+		n = 0;
+
+	if (n == 0 || n > len)
+	{
+		*cp = -1;
+		return 1;
+	}
+
+	for (j = 1; j < n; j++)
+	{
+		if ((s[j] & 0xC0) != 0x80)
+		{
+			*cp = -1;
+			return 1;
+		}
+
+		*cp = (*cp << 6) | (s[j] & 0x3F);
+	}
+
+	/* Overlong forms, surrogates and code points past Unicode are not valid. */
+	if (*cp < min || *cp > 0x10FFFF || (*cp >= 0xD800 && *cp <= 0xDFFF))
+	{
+		*cp = -1;
+		return 1;
+	}
+
+	return n;
+}
+
+
+
+
+/* Function that tells how many screen columns a code point takes. Bytes that */
+/* did not decode, shown as '?', take one.                                    */
+int kiloCharWidth(int cp)
+{
+	size_t j;
+
+	if (cp < 0x10000)
+	{
+		if (!kiloWidthsReady)
+			kiloWidthInit();
+
+		return cp < 0 ? 1 : kiloWidths[cp];
+	}
+
+	for (j = 0; j < sizeof(kiloWide) / sizeof(kiloWide[0]); j++)
+		if (cp >= kiloWide[j][0] && cp <= kiloWide[j][1])
+			return 2;
+
+	return 1;
+}
+
+
+
+
+
+/* ====[ROWS]============================================================================================================= */
+
+
+
+
+
+/* Function responsible for translating the text relative to the cursor position to */
+/* the frame relative to the render target.											*/
+int kiloRowCxToRx(erow *row, int cx)
+{
+	int rx = 0;
+	int j;
+
+	if (row->rope)
+	{
+		struct kiloRope *r = row->rope;
+		int rem;
+		int i = kiloRopeFind(r, r->bytes, cx, &rem);
+
+		if (i == r->n)
+			return kiloRopePrefix(r->widths, r->n);
+
+		return kiloRopePrefix(r->widths, i) + kiloTextWidth(r->chunks[i].data, rem);
+	}
+
+	if (!kiloRowAscii(row))
+	{
+		for (j = 0; j < cx && j < row->size; )
+		{
+			int cp;
+
+			if (row->chars[j] == '\t')
+			{
+				rx += KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+				j++;
+			}
+
+			else
+			{
+				j += kiloUtf8Decode(&row->chars[j], row->size - j, &cp);
+				rx += kiloCharWidth(cp);
+			}
+		}
+
+		return rx;
+	}
+
+	for (j = 0; j < cx; j++)
+	{
+		if (row->chars[j] == '\t')
+			rx += ((KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP));
+
+		rx++;
+	}
+	return rx;
+}
+
+
+
+
+/* Function that tells whether a row is all ASCII, also for a row that has not */
+/* been rendered yet and so has not been classified.                          */
+static int kiloRowAscii(erow *row)
+{
+	if (row->render == NULL && row->rope == NULL)
+		return kiloIsAscii(row->chars, row->size);
+
+	return row->ascii;
+}
+
+
+
+
+/* Function that finds where screen column "rx" starts in a row's render. It  */
+/* returns the byte offset of the first character at or after that column,   */
+/* and stores in *cut how many columns of a wide character cut in half by it  */
+/* are left over, which the caller fills with spaces.                         */
+int kiloRowRenderOffset(erow *row, int rx, int *cut)
+{
+	int j = 0;
+	int col = 0;
+
+	*cut = 0;
+
+	if (row->ascii || row->rope)
+		return rx < row->rsize ? rx : row->rsize;
+
+	while (j < row->rsize && col < rx)
+	{
+		int cp;
+
+		j += kiloUtf8Decode(&row->render[j], row->rsize - j, &cp);
+		col += kiloCharWidth(cp);
+	}
+
+	if (col > rx)
+		*cut = col - rx;
+
+	return j;
+}
+
+
+
+
+/* Functions responsible for moving a cursor position one character to the  */
+/* right or to the left, over all the bytes of a UTF-8 sequence at once.    */
+/* Long rows are always stepped a byte at a time.                           */
+int kiloRowNextChar(erow *row, int cx)
+{
+	int cp;
+
+	if (cx >= row->size)
+		return row->size;
+
+	if (kiloRowAscii(row) || row->rope)
+		return cx + 1;
+
+	return cx + kiloUtf8Decode(&row->chars[cx], row->size - cx, &cp);
+}
+
+
+
+
+int kiloRowPrevChar(erow *row, int cx)
+{
+	int start = cx - 1;
+	int cp;
+
+	if (cx <= 0)
+		return 0;
+
+	if (kiloRowAscii(row) || row->rope)
+		return cx - 1;
+
+	while (start > 0 && cx - start < 4 && (row->chars[start] & 0xC0) == 0x80)
+		start--;
+
+	if (start + kiloUtf8Decode(&row->chars[start], row->size - start, &cp) != cx)
+		return cx - 1;
+
+	return start;
+}
+
+
+
+
+/* Function that moves a cursor position that fell inside a UTF-8 sequence, */
+/* say after moving up or down, back to the start of that character.       */
+int kiloRowSnap(erow *row, int cx)
+{
+	int start = cx;
+	int cp;
+
+	if (kiloRowAscii(row) || row->rope || cx >= row->size)
+		return cx;
+
+	while (start > 0 && cx - start < 3 && (row->chars[start] & 0xC0) == 0x80)
+		start--;
+
+	if (start + kiloUtf8Decode(&row->chars[start], row->size - start, &cp) > cx)
+		return start;
+
+	return cx;
+}
+
+
+
+
+/* Function responsible for copying "len" bytes of a row from byte "from" on. */
+void kiloRowRead(erow *row, int from, int len, char *dst)
+{
+	if (row->rope)
+		kiloRopeRead(row->rope, from, len, dst);
+	else
+		memcpy(dst, &row->chars[from], len);
+}
+
+
+
+
+/* Function that hands out the text of a row piece by piece, for writing it out */
+/* without a copy: a short row is one piece, a long row one per chunk. Start    */
+/* with *piece at 0; NULL is returned after the last piece.                     */
+const char *kiloRowPiece(erow *row, int *piece, int *len)
+{
+	if (row->rope == NULL)
+	{
+		if ((*piece)++ > 0)
+			return NULL;
+
+		*len = row->size;
+		return row->chars;
+	}
+
+	if (*piece >= row->rope->n)
+		return NULL;
+
+	struct kiloChunk *c = &row->rope->chunks[(*piece)++];
+
+	*len = c->len;
+	return c->data;
+}
+
+
+
+
+/* Function responsible for copying the "cols" screen columns of a row that start */
+/* at column "col" into "dst". Returns the number of bytes copied.                */
+int kiloRowWindow(erow *row, int col, int cols, char *dst)
+{
+	if (row->rope)
+		return kiloRopeWindow(row->rope, col, cols, dst);
+
+	int len = row->rsize - col;
+
+	if (len < 0)
+		len = 0;
+	if (len > cols)
+		len = cols;
+
+	memcpy(dst, &row->render[col], len);
+	return len;
+}
+
+
+
+
+/* Function that is responsible for rendering the contents of a row. Tabs are   */
+/* expanded to the next tab stop; in UTF-8 rows the stops count columns, not  */
+/* bytes, and everything else is copied through as it is.                     */
+static void kiloRenderRow(struct kiloBuffer *b, erow *row)
+{
+	int j;
+	int tabs = 0;
+	/* idx will contain the number of characters we will be copying into */
+	/* row->render.														 */
+	int idx = 0;
+	/* The column idx lands on, which is idx itself in ASCII rows. */
+	int col = 0;
+
+	/* Calculate the amount of tabs on the current line.*/
+	for (j = 0; j < row->size && row->rope == NULL; j++)
+		if (row->chars[j] == '\t')
+			tabs++;
+
+	/* The render and its highlight classes are allocated together. Long rows */
+	/* only get an empty one, which the highlighter passes straight through.  */
+	int cap = row->rope ? 0 : row->size + (tabs * (KILO_TAB_STOP - 1));
+
+	size_t oldsize = kiloMemSize(row->render);
+
+	free(row->render);
+	row->render = malloc((cap + 1) + cap);
+	row->hl = (unsigned char *) &row->render[cap + 1];
+
+	kiloMemAdjust(b, &b->mem_render, oldsize, kiloMemSize(row->render));
+
+	row->ascii = row->rope ? 0 : kiloIsAscii(row->chars, row->size);
+
+	/* Now render the tabs detected as a series of spaces. */
+	for (j = 0; j < row->size && row->ascii; j++)
+		if (row->chars[j] == '\t')
+		{
+			row->render[idx++] = ' ';
+
+			while ((idx % KILO_TAB_STOP) != 0)
+				row->render[idx++] = ' ';
+		}
+
+		else
+			row->render[idx++] = row->chars[j];
+
+	for (j = 0; j < row->size && !row->ascii && row->rope == NULL; )
+		if (row->chars[j] == '\t')
+		{
+			int stop = col + KILO_TAB_STOP - (col % KILO_TAB_STOP);
+
+			while (col < stop)
+			{
+				row->render[idx++] = ' ';
+				col++;
+			}
+
+			j++;
+		}
+
+		else
+		{
+			int cp;
+			int n = kiloUtf8Decode(&row->chars[j], row->size - j, &cp);
+
+			memcpy(&row->render[idx], &row->chars[j], n);
+			idx += n;
+			j += n;
+			col += kiloCharWidth(cp);
+		}
+
+	row->render[idx] = '\0';
+	row->rsize = idx;
+	row->version++;
+}
+
+
+
+
+/* Function responsible for rendering a row again and telling the owner about it. */
+void kiloUpdateRow(struct kiloBuffer *b, erow *row)
+{
+	kiloRenderRow(b, row);
+
+	if (b->hooks.render)
+		b->hooks.render(b, row);
+}
+
+
+
+
+/* Function responsible for rendering a row added by kiloAppendShared(), the */
+/* first time it is needed. Rows that have been rendered are left alone.     */
+void kiloRowRender(struct kiloBuffer *b, erow *row)
+{
+	if (row->render == NULL && row->rope == NULL && !row->stale)
+		kiloUpdateRow(b, row);
+}
+
+
+
+
+/* Function responsible for catching a row's render up with its chars. Inside a */
+/* batch the row is only flagged, and rendered once when the batch ends.        */
+static void kiloRowChanged(struct kiloBuffer *b, erow *row)
+{
+	if (b->batch == 0)
+	{
+		kiloUpdateRow(b, row);
+		return;
+	}
+
+	if (row->stale)
+		return;
+
+	int at = row - b->row;
+
+	row->stale = 1;
+
+	if (at < b->stale_lo)
+		b->stale_lo = at;
+	if (at > b->stale_hi)
+		b->stale_hi = at;
+}
+
+
+
+
+/* Function responsible for noting that "n" rows were added at "at", or -n rows */
+/* removed from there when n is negative. Inside a batch the stale range moves  */
+/* along with the rows and the owner is only told once, when the batch ends.    */
+static void kiloRowsShifted(struct kiloBuffer *b, int at, int n)
+{
+	b->layout_changed = 1;
+
+	if (b->batch == 0)
+	{
+		if (b->hooks.shift)
+			b->hooks.shift(b, at);
+
+		return;
+	}
+
+	if (b->shift_at == -1 || at < b->shift_at)
+		b->shift_at = at;
+
+	if (b->stale_hi < at)
+		return;
+
+	/* Rows that were removed take their stale flags with them. */
+	int end = (n < 0) ? at - n : at;
+
+	if (b->stale_hi >= end)
+		b->stale_hi += n;
+	else
+		b->stale_hi = at - 1;
+
+	if (b->stale_lo >= end)
+		b->stale_lo += n;
+	else if (b->stale_lo >= at)
+		b->stale_lo = at;
+}
+
+
+
+
+/* Structure that holds the text of a row that went to a clipboard, for the     */
+/* clipboard and every row with that text to share. The text never changes; it  */
+/* is released by whichever lets go of it last, and no buffer counts its memory. */
+struct kiloShare
+{
+	int refs;
+	int size;
+	char *chars;
+	struct kiloRope *rope;
+	size_t mem;
+};
+
+
+
+
+/* Function responsible for letting go of a reference to shared text. */
+static void kiloShareDrop(struct kiloShare *s)
+{
+	if (--s->refs > 0)
+		return;
+
+	if (s->rope)
+	{
+		struct kiloBuffer none;
+
+		memset(&none, 0, sizeof(none));
+		kiloRopeFree(&none, s->rope);
+	}
+
+	free(s->chars);
+	free(s);
+}
+
+
+
+
+/* Function that returns a new reference to the text of a row, as shared text.  */
+/* A row that owns its text hands it over to be shared, which copies nothing;   */
+/* text the buffer does not own could go away with whatever holds it, and is    */
+/* copied, as are empty rows, whose chars may be NULL.                          */
+static struct kiloShare *kiloRowShare(struct kiloBuffer *b, erow *row)
+{
+	struct kiloShare *s = row->share;
+
+	if (s == NULL)
+	{
+		s = calloc(1, sizeof(struct kiloShare));
+		s->size = row->size;
+
+		if (row->shared || row->size == 0)
+		{
+			s->chars = malloc(row->size + 1);
+			memcpy(s->chars, row->size ? row->chars : "", row->size);
+			s->chars[row->size] = '\0';
+			s->mem = kiloMemSize(s->chars);
+		}
+
+		else
+		{
+			int count = 1;
+
+			if (row->rope)
+				s->mem = kiloRopeMem(row->rope, &count);
+			else
+				s->mem = kiloMemSize(row->chars);
+
+			s->chars = row->chars;
+			s->rope = row->rope;
+			s->refs = 1;
+
+			b->mem_chars -= s->mem;
+			b->nalloc -= count;
+
+			row->share = s;
+			row->shared = 1;
+		}
+	}
+
+	s->refs++;
+	return s;
+}
+
+
+
+
+/* Function responsible for letting go of text a row does not own, copying */
+/* nothing, before the row gets new text or is released.                  */
+static void kiloRowUnshare(erow *row)
+{
+	if (!row->shared)
+		return;
+
+	if (row->share)
+	{
+		kiloShareDrop(row->share);
+		row->share = NULL;
+		row->rope = NULL;
+	}
+
+	row->chars = NULL;
+	row->shared = 0;
+}
+
+
+
+
+/* Function responsible for giving a row its own copy of text that it shares, */
+/* before the text is changed.                                               */
+static void kiloRowOwn(struct kiloBuffer *b, erow *row)
+{
+	if (!row->shared)
+		return;
+
+	if (row->rope)
+		row->rope = kiloRopeClone(b, row->rope);
+
+	else
+	{
+		char *chars = malloc(row->size + 1);
+
+		memcpy(chars, row->chars, row->size);
+		chars[row->size] = '\0';
+		kiloMemAdjust(b, &b->mem_chars, 0, kiloMemSize(chars));
+
+		row->chars = chars;
+	}
+
+	if (row->share)
+	{
+		kiloShareDrop(row->share);
+		row->share = NULL;
+	}
+
+	row->shared = 0;
+}
+
+
+
+
+/* Function responsible for moving a row between its two forms, a single block */
+/* and a rope, once it crosses KILO_LONG_ROW in either direction.              */
+static void kiloRowNormalize(struct kiloBuffer *b, erow *row)
+{
+	if (row->rope == NULL && row->size > KILO_LONG_ROW)
+	{
+		row->rope = kiloRopeFromText(b, row->chars, row->size);
+
+		kiloMemAdjust(b, &b->mem_chars, kiloMemSize(row->chars), 0);
+		free(row->chars);
+		row->chars = NULL;
+	}
+
+	else if (row->rope && row->size < KILO_LONG_ROW / 2)
+	{
+		char *chars = malloc(row->size + 1);
+
+		kiloRopeRead(row->rope, 0, row->size, chars);
+		chars[row->size] = '\0';
+		kiloMemAdjust(b, &b->mem_chars, 0, kiloMemSize(chars));
+
+		kiloRopeFree(b, row->rope);
+		row->rope = NULL;
+		row->chars = chars;
+	}
+}
+
+
+
+
+/* Function responsible for replacing "dellen" bytes of a row at "at" with "len" */
+/* bytes of "s". The row is neither rendered nor flagged dirty here.             */
+static void kiloRowSplice(struct kiloBuffer *b, erow *row, int at, int dellen, const char *s, int len)
+{
+	kiloRowOwn(b, row);
+
+	if (row->rope)
+	{
+		kiloRopeDelete(b, row->rope, at, dellen);
+		kiloRopeInsert(b, row->rope, at, s, len);
+	}
+
+	else
+	{
+		int newsize = row->size - dellen + len;
+		size_t oldsize = kiloMemSize(row->chars);
+
+		if (row->chars == NULL || len > dellen)
+			row->chars = realloc(row->chars, newsize + 1);
+
+		kiloMemAdjust(b, &b->mem_chars, oldsize, kiloMemSize(row->chars));
+
+		memmove(&row->chars[at + len], &row->chars[at + dellen], row->size - (at + dellen));
+		memcpy(&row->chars[at], s, len);
+		row->chars[newsize] = '\0';
+	}
+
+	row->size += len - dellen;
+	kiloRowNormalize(b, row);
+}
+
+
+
+
+/* Function responsible for moving what follows byte "col" of row "src" into the */
+/* empty row "dst". A long row hands its chunks over instead of copying them.   */
+static void kiloRowSplitTail(struct kiloBuffer *b, erow *src, int col, erow *dst)
+{
+	int taillen = src->size - col;
+
+	kiloRowOwn(b, src);
+
+	if (src->rope)
+		dst->rope = kiloRopeSplit(b, src->rope, col);
+
+	else
+	{
+		dst->chars = malloc(taillen + 1);
+		memcpy(dst->chars, &src->chars[col], taillen);
+		dst->chars[taillen] = '\0';
+		kiloMemAdjust(b, &b->mem_chars, 0, kiloMemSize(dst->chars));
+
+		src->chars[col] = '\0';
+	}
+
+	dst->size = taillen;
+	src->size = col;
+
+	kiloRowNormalize(b, src);
+	kiloRowNormalize(b, dst);
+}
+
+
+
+
+/* Function responsible for appending what follows byte "col" of row "last" to */
+/* row "r". "last" is about to be released and may be left with anything.     */
+static void kiloRowJoin(struct kiloBuffer *b, erow *r, erow *last, int col)
+{
+	int restlen = last->size - col;
+
+	if (last->rope == NULL)
+	{
+		kiloRowSplice(b, r, r->size, 0, &last->chars[col], restlen);
+		return;
+	}
+
+	kiloRowOwn(b, last);
+	kiloRowOwn(b, r);
+
+	struct kiloRope *rest = kiloRopeSplit(b, last->rope, col);
+	last->size = col;
+
+	if (r->rope)
+		kiloRopeAppend(b, r->rope, rest);
+
+	else
+	{
+		kiloRopeInsert(b, rest, 0, r->chars, r->size);
+
+		kiloMemAdjust(b, &b->mem_chars, kiloMemSize(r->chars), 0);
+		free(r->chars);
+		r->chars = NULL;
+		r->rope = rest;
+	}
+
+	r->size += restlen;
+	kiloRowNormalize(b, r);
+}
+
+
+
+
+/* Function responsible for releasing the memory held by a row. */
+static void kiloFreeRow(struct kiloBuffer *b, erow *row)
+{
+	if (b->hooks.release)
+		b->hooks.release(b, row);
+
+	kiloRowUnshare(row);
+
+	kiloMemAdjust(b, &b->mem_chars, kiloMemSize(row->chars), 0);
+	kiloMemAdjust(b, &b->mem_render, kiloMemSize(row->render), 0);
+
+	if (row->rope)
+		kiloRopeFree(b, row->rope);
+
+	free(row->chars);
+	free(row->render);
+}
+
+
+
+
+/* Function responsible for making room for "n" empty rows at index "at", moving */
+/* the rows below them down with a single memmove().                            */
+void kiloInsertRows(struct kiloBuffer *b, int at, int n)
+{
+	if (b->numrows + n > b->rowcap)
+	{
+		/* Grow geometrically so that appending rows one at a time stays cheap. */
+		size_t oldsize = kiloMemSize(b->row);
+
+		b->rowcap = (b->numrows + n) * 2;
+		b->row = realloc(b->row, sizeof(erow) * b->rowcap);
+
+		kiloMemAdjust(b, &b->mem_rows, oldsize, kiloMemSize(b->row));
+	}
+
+	memmove(&b->row[at + n], &b->row[at], sizeof(erow) * (b->numrows - at));
+
+	int j;
+	for (j = at; j < at + n; j++)
+	{
+		b->row[j].size = 0;
+		b->row[j].chars = NULL;
+		b->row[j].rsize = 0;
+		b->row[j].render = NULL;
+		b->row[j].rope = NULL;
+		b->row[j].hl = NULL;
+		b->row[j].hl_state = 0;
+		b->row[j].hl_ready = 1;
+		b->row[j].version = 0;
+		b->row[j].ascii = 1;
+
+		b->row[j].offset = -1;
+		b->row[j].origsize = 0;
+		b->row[j].dirty = 0;
+		b->row[j].stale = 0;
+		b->row[j].shared = 0;
+		b->row[j].share = NULL;
+		b->row[j].fold = 0;
+	}
+
+	b->numrows += n;
+
+	kiloRowsShifted(b, at, n);
+}
+
+
+
+
+/* Function responsible for replacing the contents of a row with the concatenation */
+/* of "a" and "s", and rendering it again. Either part may point into the row.     */
+void kiloRowSetChars(struct kiloBuffer *b, erow *row, const char *a, int alen, const char *s, int slen)
+{
+	char *chars = malloc(alen + slen + 1);
+
+	memcpy(chars, a, alen);
+	memcpy(&chars[alen], s, slen);
+	chars[alen + slen] = '\0';
+
+	kiloRowUnshare(row);
+	kiloMemAdjust(b, &b->mem_chars, kiloMemSize(row->chars), kiloMemSize(chars));
+
+	free(row->chars);
+	row->chars = chars;
+	row->size = alen + slen;
+
+	if (row->rope)
+	{
+		kiloRopeFree(b, row->rope);
+		row->rope = NULL;
+	}
+
+	kiloRowNormalize(b, row);
+	kiloRowMarkDirty(b, row);
+	kiloRowChanged(b, row);
+}
+
+
+
+
+/* Function similar to abAppend() in that it is responsible for */
+/* as the name implies, appending a row of text. With that,     */
+/* That means that this function must also be incharge of       */
+/* memory resource allocation.									*/
+void kiloAppendRow(struct kiloBuffer *b, const char *s, size_t len)
+{
+	/* Here, "at" will represent the reallocation target row. */
+	int at = b->numrows;
+
+	kiloInsertRows(b, at, 1);
+
+	b->row[at].size = len;
+
+	if (len > KILO_LONG_ROW)
+		b->row[at].rope = kiloRopeFromText(b, s, len);
+
+	else
+	{
+		b->row[at].chars = malloc(len + 1);
+		kiloMemAdjust(b, &b->mem_chars, 0, kiloMemSize(b->row[at].chars));
+
+		/* Transfer the old + new data into the newly reallocated row. */
+		memcpy(b->row[at].chars, s, len);
+
+		/* Append an EOF at the end of the row, and move on to the next. */
+		b->row[at].chars[len] = '\0';
+	}
+
+	kiloRowChanged(b, &b->row[at]);
+}
+
+
+
+
+/* Function responsible for appending a row whose text stays where it is, in      */
+/* memory the buffer does not own and that must outlive the row, such as a file   */
+/* mapped by the caller. Nothing is copied or rendered: the row copies its text   */
+/* when it is first edited and is rendered by kiloRowRender(). Text longer than   */
+/* KILO_LONG_ROW should go through kiloAppendRow() instead.                       */
+void kiloAppendShared(struct kiloBuffer *b, const char *s, int len)
+{
+	int at = b->numrows;
+
+	kiloInsertRows(b, at, 1);
+
+	b->row[at].chars = (char *) s;
+	b->row[at].size = len;
+	b->row[at].shared = 1;
+}
+
+
+
+
+/* Function responsible for appending text to the end of a row without going   */
+/* through the edit hooks or flagging it dirty, for loading a line that is too  */
+/* long to be buffered in one piece.                                            */
+void kiloRowAppend(struct kiloBuffer *b, erow *row, const char *s, int len)
+{
+	kiloRowSplice(b, row, row->size, 0, s, len);
+	kiloRowChanged(b, row);
+}
+
+
+
+
+/* Function responsible for flagging a row as different from the file on disk. */
+void kiloRowMarkDirty(struct kiloBuffer *b, erow *row)
+{
+	if (row->dirty)
+		return;
+
+	row->dirty = 1;
+
+	b->dirtyrows = realloc(b->dirtyrows, sizeof(int) * (b->ndirty + 1));
+	b->dirtyrows[b->ndirty++] = row - b->row;
+}
+
+
+
+
+
+/* ====[TEXT]============================================================================================================= */
+
+
+
+
+
+/* Function responsible for inserting "len" bytes of text at (row, col). The text */
+/* may span several lines: the rows it creates are spliced into the row array in   */
+/* one go and every affected row is rendered exactly once. Inserting on the row   */
+/* just past the end of the file appends a row first. The position right after    */
+/* the inserted text is stored in *endrow and *endcol when they are not NULL.     */
+/* Returns 0, or -1 when "row" is out of range.                                   */
+int kiloInsertText(struct kiloBuffer *b, int row, int col, const char *s, int len, int *endrow, int *endcol)
+{
+	if (row < 0 || row > b->numrows)
+		return -1;
+
+	if (row == b->numrows)
+	{
+		/* Appending a row is the same as inserting a newline at the end of the file. */
+		if (b->numrows > 0)
+			kiloInsertText(b, row - 1, b->row[row - 1].size, "\n", 1, NULL, NULL);
+		else
+			kiloAppendRow(b, "", 0);
+	}
+
+	erow *r = &b->row[row];
+
+	/* Check the position/bounds of col relative to the length of the row. */
+	if (col < 0 || col > r->size)
+		col = r->size;
+
+	if (b->hooks.edit)
+		b->hooks.edit(b, KILO_EDIT_INSERT, row, col, s, len);
+
+	const char *nl = memchr(s, '\n', len);
+
+	if (nl == NULL)
+	{
+		/* The common case of text that stays within the row. */
+		kiloRowSplice(b, r, col, 0, s, len);
+
+		kiloRowMarkDirty(b, r);
+		kiloRowChanged(b, r);
+
+		if (endrow)
+			*endrow = row;
+		if (endcol)
+			*endcol = col + len;
+
+		return 0;
+	}
+
+	int nlines = 0;
+	const char *p;
+
+	for (p = nl; p; p = memchr(p + 1, '\n', (s + len) - (p + 1)))
+		nlines++;
+
+	/* What follows the insertion point ends up after the last line of the text. */
+	int taillen = r->size - col;
+
+	kiloInsertRows(b, row + 1, nlines);
+
+	erow *last = &b->row[row + nlines];
+	kiloRowSplitTail(b, &b->row[row], col, last);
+
+	/* The first line of the text completes the row the insertion started on. */
+	r = &b->row[row];
+	kiloRowSplice(b, r, col, 0, s, nl - s);
+	kiloRowMarkDirty(b, r);
+	kiloRowChanged(b, r);
+
+	int j;
+	p = nl + 1;
+
+	for (j = 1; j <= nlines; j++)
+	{
+		const char *next = memchr(p, '\n', (s + len) - p);
+		int n = (next ? next : s + len) - p;
+
+		if (j < nlines)
+			kiloRowSetChars(b, &b->row[row + j], p, n, "", 0);
+
+		else
+		{
+			kiloRowSplice(b, last, 0, 0, p, n);
+			kiloRowMarkDirty(b, last);
+			kiloRowChanged(b, last);
+		}
+
+		p += n + 1;
+	}
+
+	if (endrow)
+		*endrow = row + nlines;
+	if (endcol)
+		*endcol = last->size - taillen;
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for walking "len" bytes forward from (row, col), counting */
+/* the end of each row as one byte. The end of the file stops the walk.           */
+int kiloTextEnd(struct kiloBuffer *b, int row, int col, int len, int *endrow, int *endcol)
+{
+	int walked = 0;
+
+	while (len > walked)
+	{
+		int avail = b->row[row].size - col;
+
+		if (len - walked <= avail)
+		{
+			col += len - walked;
+			walked = len;
+		}
+
+		else if (row + 1 < b->numrows)
+		{
+			walked += avail + 1;
+			row++;
+			col = 0;
+		}
+
+		else
+		{
+			walked += avail;
+			col = b->row[row].size;
+			break;
+		}
+	}
+
+	*endrow = row;
+	*endcol = col;
+
+	return walked;
+}
+
+
+
+
+/* Function responsible for copying the text between two positions into a newly */
+/* allocated buffer, with a newline between rows. The caller is free().          */
+char *kiloCopyText(struct kiloBuffer *b, int row, int col, int endrow, int endcol, int len)
+{
+	char *buf = malloc(len + 1);
+	char *p = buf;
+
+	while (row < endrow)
+	{
+		kiloRowRead(&b->row[row], col, b->row[row].size - col, p);
+		p += b->row[row].size - col;
+		*p++ = '\n';
+
+		row++;
+		col = 0;
+	}
+
+	kiloRowRead(&b->row[row], col, endcol - col, p);
+
+	return buf;
+}
+
+
+
+
+/* Function responsible for deleting "len" bytes of text starting at (row, col), */
+/* where the end of each row counts as one byte. The rows the deletion covers    */
+/* are removed from the row array with a single memmove(). Returns the number of */
+/* bytes deleted, or -1 when "row" is out of range.                              */
+int kiloDeleteText(struct kiloBuffer *b, int row, int col, int len)
+{
+	if (row < 0 || row >= b->numrows)
+		return -1;
+
+	if (len <= 0)
+		return 0;
+
+	if (col < 0 || col > b->row[row].size)
+		col = b->row[row].size;
+
+	int endrow, endcol;
+
+	len = kiloTextEnd(b, row, col, len, &endrow, &endcol);
+	if (len == 0)
+		return 0;
+
+	if (b->hooks.edit)
+		b->hooks.edit(b, KILO_EDIT_DELETE, row, col, NULL, len);
+
+	erow *r = &b->row[row];
+
+	if (endrow == row)
+	{
+		kiloRowSplice(b, r, col, len, "", 0);
+
+		kiloRowMarkDirty(b, r);
+		kiloRowChanged(b, r);
+		return len;
+	}
+
+	/* Join what is left of the first and the last row, then drop the rows after */
+	/* the first; the joined row is only rendered once they are gone, so that it */
+	/* hands its highlight state to the right row.                               */
+	kiloRowSplice(b, r, col, r->size - col, "", 0);
+	kiloRowJoin(b, r, &b->row[endrow], endcol);
+
+	int j;
+	for (j = row + 1; j <= endrow; j++)
+		kiloFreeRow(b, &b->row[j]);
+
+	memmove(&b->row[row + 1], &b->row[endrow + 1], sizeof(erow) * (b->numrows - (endrow + 1)));
+	b->numrows -= endrow - row;
+
+	kiloRowsShifted(b, row + 1, -(endrow - row));
+
+	r = &b->row[row];
+	kiloRowMarkDirty(b, r);
+	kiloRowChanged(b, r);
+
+	return len;
+}
+
+
+
+
+/* Function responsible for replacing rows [at, at + n) with every row of "src", */
+/* which are moved over rather than copied and leave "src" empty. This is the    */
+/* same as deleting the rows' text and inserting that of "src", and the hooks    */
+/* are told so, a block of whole rows at a time so that no length overflows.    */
+/* Replacing the whole buffer with nothing leaves one empty row. "n" may only   */
+/* be 0 when the buffer is empty. Returns 0, or -1 when the range is invalid.   */
+int kiloReplaceRows(struct kiloBuffer *b, int at, int n, struct kiloBuffer *src)
+{
+	if (at < 0 || n < 0 || at + n > b->numrows || (n == 0 && b->numrows > 0))
+		return -1;
+
+	int m = src->numrows;
+
+	if (n == 0 && m == 0)
+		return 0;
+
+	/* Rows that go without a replacement take the newline after them along, or */
+	/* the one before them at the end of the file; otherwise one row is left.   */
+	int tail = (m == 0 && at + n < b->numrows);
+	int lead = (m == 0 && at + n == b->numrows && at > 0);
+	int keep = !tail && !lead;
+	int sr = lead ? at - 1 : at;
+	int sc = lead ? b->row[at - 1].size : 0;
+	int j;
+
+	while (n > 0)
+	{
+		long long len = 0;
+		int cnt = 0;
+
+		do
+		{
+			len += b->row[at + cnt].size + (!keep || cnt < n - 1);
+			cnt++;
+		}
+		while (cnt < n && len + b->row[at + cnt].size + 1 <= INT_MAX);
+
+		if (len > 0 && b->hooks.edit)
+			b->hooks.edit(b, KILO_EDIT_DELETE, sr, sc, NULL, (int) len);
+
+		for (j = at; j < at + cnt; j++)
+			kiloFreeRow(b, &b->row[j]);
+
+		memmove(&b->row[at], &b->row[at + cnt], sizeof(erow) * (b->numrows - (at + cnt)));
+		b->numrows -= cnt;
+		n -= cnt;
+
+		kiloRowsShifted(b, at, -cnt);
+	}
+
+	if (m == 0)
+	{
+		if (keep)
+		{
+			kiloInsertRows(b, at, 1);
+			kiloRowMarkDirty(b, &b->row[at]);
+			kiloRowChanged(b, &b->row[at]);
+		}
+
+		kiloBufferFree(src);
+		return 0;
+	}
+
+	for (j = 0; j < m; j++)
+	{
+		erow *row = &src->row[j];
+		const char *s;
+		int piece = 0, col = 0, len;
+
+		if (b->hooks.edit == NULL)
+			break;
+
+		if (j > 0)
+			b->hooks.edit(b, KILO_EDIT_INSERT, at + j - 1, src->row[j - 1].size, "\n", 1);
+
+		while ((s = kiloRowPiece(row, &piece, &len)) != NULL)
+			if (len > 0)
+			{
+				b->hooks.edit(b, KILO_EDIT_INSERT, at + j, col, s, len);
+				col += len;
+			}
+	}
+
+	kiloInsertRows(b, at, m);
+	memcpy(&b->row[at], src->row, sizeof(erow) * m);
+
+	/* The rows' memory now belongs to this buffer, all but src's row array. */
+	b->mem_chars += src->mem_chars;
+	b->mem_render += src->mem_render;
+	b->nalloc += src->nalloc - 1;
+
+	src->numrows = 0;
+	src->mem_chars = 0;
+	src->mem_render = 0;
+	kiloBufferFree(src);
+
+	for (j = at; j < at + m; j++)
+	{
+		erow *row = &b->row[j];
+
+		row->offset = -1;
+		row->origsize = 0;
+		row->dirty = 0;
+		row->stale = 0;
+
+		kiloRowMarkDirty(b, row);
+	}
+
+	for (j = at; j < at + m; j++)
+		kiloRowChanged(b, &b->row[j]);
+
+	return 0;
+}
+
+
+
+
+/* Function that copies rows [at, at + n) to a new clipboard without copying their */
+/* text, which the rows and the clipboard share from then on. Returns NULL when   */
+/* the range is invalid.                                                          */
+struct kiloClip *kiloCopyRows(struct kiloBuffer *b, int at, int n)
+{
+	if (at < 0 || n < 0 || at + n > b->numrows)
+		return NULL;
+
+	struct kiloClip *clip = malloc(sizeof(struct kiloClip));
+	int j;
+
+	clip->numrows = n;
+	clip->rows = malloc(sizeof(struct kiloShare *) * (n ? n : 1));
+	clip->mem = 0;
+
+	for (j = 0; j < n; j++)
+	{
+		clip->rows[j] = kiloRowShare(b, &b->row[at + j]);
+		clip->mem += clip->rows[j]->mem;
+	}
+
+	return clip;
+}
+
+
+
+
+/* Function responsible for inserting the rows of a clipboard before row "at",   */
+/* or after the last row when "at" is numrows. The new rows share their text     */
+/* with the clipboard and, like those of kiloAppendShared(), are only rendered   */
+/* by kiloRowRender(), so this costs a row each and copies no text. The hooks    */
+/* are told it was inserted. Returns 0, or -1 when "at" is out of range.         */
+int kiloPasteRows(struct kiloBuffer *b, int at, const struct kiloClip *clip)
+{
+	if (at < 0 || at > b->numrows)
+		return -1;
+
+	int m = clip->numrows;
+	int trail = (at < b->numrows);
+	int j;
+
+	/* Each row goes in ahead of the newline that ends it, or at the end of the */
+	/* file after the newline that ends the row before it.                    */
+	for (j = 0; j < m && b->hooks.edit; j++)
+	{
+		struct kiloShare *share = clip->rows[j];
+		erow text;
+		const char *s;
+		int piece = 0, col = 0, len;
+
+		memset(&text, 0, sizeof(text));
+		text.chars = share->chars;
+		text.rope = share->rope;
+		text.size = share->size;
+
+		if (!trail && j > 0)
+			b->hooks.edit(b, KILO_EDIT_INSERT, at + j - 1, clip->rows[j - 1]->size, "\n", 1);
+		else if (!trail && at > 0)
+			b->hooks.edit(b, KILO_EDIT_INSERT, at - 1, b->row[at - 1].size, "\n", 1);
+
+		while ((s = kiloRowPiece(&text, &piece, &len)) != NULL)
+			if (len > 0)
+			{
+				b->hooks.edit(b, KILO_EDIT_INSERT, at + j, col, s, len);
+				col += len;
+			}
+
+		if (trail)
+			b->hooks.edit(b, KILO_EDIT_INSERT, at + j, col, "\n", 1);
+	}
+
+	kiloInsertRows(b, at, m);
+
+	for (j = 0; j < m; j++)
+	{
+		struct kiloShare *share = clip->rows[j];
+		erow *row = &b->row[at + j];
+
+		share->refs++;
+
+		row->chars = share->chars;
+		row->rope = share->rope;
+		row->size = share->size;
+		row->shared = 1;
+		row->share = share;
+
+		kiloRowMarkDirty(b, row);
+
+		/* Long rows are never rendered as a whole, so that costs nothing. */
+		if (row->rope)
+			kiloRowChanged(b, row);
+	}
+
+	return 0;
+}
+
+
+
+
+/* Function responsible for releasing a clipboard. The rows pasted from it keep */
+/* their text. "clip" may be NULL.                                              */
+void kiloClipFree(struct kiloClip *clip)
+{
+	int j;
+
+	if (clip == NULL)
+		return;
+
+	for (j = 0; j < clip->numrows; j++)
+		kiloShareDrop(clip->rows[j]);
+
+	free(clip->rows);
+	free(clip);
+}
+
+
+
+
+/* Function responsible for inserting a typed character at the cursor. */
+void kiloInsertChar(struct kiloBuffer *b, int c)
+{
+	char ch = c;
+
+	/* Call the routine responsible for processing characters to be inserted. It */
+	/* moves the cursor to the next place in the row, or to the next row.       */
+	kiloInsertText(b, b->cy, b->cx, &ch, 1, &b->cy, &b->cx);
+}
+
+
+
+
+/* Function responsible for the backspace key: deletes the character before the */
+/* cursor, joining the row with the previous one at the start of a row.         */
+void kiloDelChar(struct kiloBuffer *b)
+{
+	if (b->cy == b->numrows || (b->cx == 0 && b->cy == 0))
+		return;
+
+	int len = 1;
+
+	if (b->cx > 0)
+	{
+		int at = kiloRowPrevChar(&b->row[b->cy], b->cx);
+
+		len = b->cx - at;
+		b->cx = at;
+	}
+
+	else
+	{
+		b->cy--;
+		b->cx = b->row[b->cy].size;
+	}
+
+	kiloDeleteText(b, b->cy, b->cx, len);
+}
+
+
+
+
+/* Function responsible for joining the rows into one newline separated buffer. The */
+/* length is a size_t, as files can be several GiB; NULL when memory runs out.      */
+char *kiloRowsToString(struct kiloBuffer *b, size_t *buflen)
+{
+	size_t totlen = 0;
+	int j;
+
+	/* Calculate the size of the file. */
+	for (j = 0; j < b->numrows; j++)
+		totlen += b->row[j].size + 1;
+
+	/* The length of the file buffer is equal to the calculated "total" length. */
+	*buflen = totlen;
+
+	/* Allocate the space for the file-to-storage buffer. */
+	char *buf = malloc(totlen);
+	char *p = buf;
+
+	if (buf == NULL)
+		return NULL;
+
+	for (j = 0; j < b->numrows; j++)
+	{
+		kiloRowRead(&b->row[j], 0, b->row[j].size, p);
+
+		/* Advance the storage access buffer forward to the next row. */
+		p += b->row[j].size;
+		*p = '\n';
+		p++;
+	}
+
+	/* The expected caller is free(). */
+	return buf;
+}
+
+
+
+
+
+/* ====[BATCHES]========================================================================================================== */
+
+
+
+
+
+/* Function responsible for opening a batch. Until the matching kiloEndBatch() */
+/* edits only touch chars; batches nest, and only the outermost one counts.    */
+void kiloBeginBatch(struct kiloBuffer *b)
+{
+	if (b->batch++ > 0)
+		return;
+
+	b->stale_lo = INT_MAX;
+	b->stale_hi = -1;
+	b->shift_at = -1;
+}
+
+
+
+
+/* Function responsible for closing a batch: every row it changed is rendered  */
+/* once, then the owner is told about moved rows once and about each rendered  */
+/* row in order, so that work that flows down the rows (highlighting) is done  */
+/* once for the whole batch rather than once per edit.                         */
+void kiloEndBatch(struct kiloBuffer *b)
+{
+	if (b->batch == 0 || --b->batch > 0)
+		return;
+
+	int hi = (b->stale_hi < b->numrows) ? b->stale_hi : b->numrows - 1;
+	int j;
+
+	for (j = b->stale_lo; j <= hi; j++)
+		if (b->row[j].stale)
+			kiloRenderRow(b, &b->row[j]);
+
+	if (b->shift_at != -1 && b->hooks.shift)
+		b->hooks.shift(b, b->shift_at);
+
+	for (j = b->stale_lo; j <= hi; j++)
+		if (b->row[j].stale)
+		{
+			b->row[j].stale = 0;
+
+			if (b->hooks.render)
+				b->hooks.render(b, &b->row[j]);
+		}
+
+	b->shift_at = -1;
+
+	/* The edits may have pulled the text out from under the cursor. */
+	if (b->cy > b->numrows)
+		b->cy = b->numrows;
+
+	if (b->cy < b->numrows && b->cx > b->row[b->cy].size)
+		b->cx = b->row[b->cy].size;
+	else if (b->cy == b->numrows)
+		b->cx = 0;
+}
+
+
+
+
+/* Function responsible for applying a list of edits in a single batch. Each edit */
+/* sees the buffer as the ones before it left it. Returns the number of edits     */
+/* applied; the others were out of range and skipped.                             */
+int kiloApply(struct kiloBuffer *b, const struct kiloEdit *edits, int n)
+{
+	int applied = 0;
+	int j;
+
+	kiloBeginBatch(b);
+
+	for (j = 0; j < n; j++)
+	{
+		const struct kiloEdit *e = &edits[j];
+
+		switch (e->op)
+		{
+			case KILO_EDIT_INSERT:
+				applied += (kiloInsertText(b, e->row, e->col, e->s, e->len, NULL, NULL) == 0);
+				break;
+
+			case KILO_EDIT_SPLIT:
+				applied += (kiloInsertText(b, e->row, e->col, "\n", 1, NULL, NULL) == 0);
+				break;
+
+			case KILO_EDIT_DELETE:
+				applied += (kiloDeleteText(b, e->row, e->col, e->len) >= 0);
+				break;
+		}
+	}
+
+	kiloEndBatch(b);
+
+	return applied;
+}
+/* ====[END-OF-FILE]====================================================================================================== */
@@ -0,0 +1,248 @@
+
+
+
+
+
+/* File:	 kilo_core.h														*/
+/* ====[DESCRIPTION]=========================================================== */
+/* The editor core: the rows of a buffer, the cursor, and the text primitives	*/
+/* that edit them. Nothing in here knows about the terminal and every function	*/
+/* works on the buffer it is handed, so several buffers can live side by side	*/
+/* and the core can be driven from a program or a test as well as from kilo.	*/
+/* Build it with "make libkilocore.a".											*/
+/* ============================================================================ */
+
+
+
+
+
+#ifndef KILO_CORE_H
+#define KILO_CORE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+
+
+
+/* ====[DEFINES]========================================================================================================== */
+
+
+
+
+
+#define KILO_TAB_STOP	8
+
+/* Rows longer than KILO_LONG_ROW bytes are kept as a rope of chunks of about */
+/* KILO_ROPE_CHUNK bytes instead of one block, and go back to a block once    */
+/* they are under half that again. See struct kiloRope in kilo_core.c.        */
+#ifndef KILO_LONG_ROW
+#define KILO_LONG_ROW	(256 * 1024)
+#endif
+#ifndef KILO_ROPE_CHUNK
+#define KILO_ROPE_CHUNK	8192
+#endif
+
+
+
+
+
+struct kiloRope;
+struct kiloShare;
+
+/* Structure that defines what a row of data is. */
+typedef struct erow
+{
+	int size;
+	int rsize;
+
+	char *chars;
+	/* Rows added with kiloAppendShared() or kiloPasteRows() start out with a */
+	/* render of NULL and are only rendered once kiloRowRender() is called.   */
+	char *render;
+	/* Long rows keep their text here instead of in chars, which is then NULL.   */
+	/* They are never rendered as a whole: render is empty, rsize 0, and the     */
+	/* columns on screen are pulled out with kiloRowWindow(). Tabs in long rows  */
+	/* are always KILO_TAB_STOP columns wide, wherever they are.                 */
+	struct kiloRope *rope;
+	/* Highlight class of every byte of render. It shares render's allocation, right */
+	/* after it, so that a row's text and colours are one block of memory.          */
+	unsigned char *hl;
+	/* The highlight state carried into the next row; 0 for none. */
+	int hl_state;
+	/* Set once hl matches render and the state of the previous row. Rows that are */
+	/* not ready are drawn without colours until the background highlighter is done. */
+	int hl_ready;
+	/* Bumped whenever render changes, so that stale background results are dropped. */
+	unsigned int version;
+	/* Set when the row is plain ASCII and every byte of render is one column.   */
+	/* Other rows are UTF-8: render keeps the encoded bytes, hl has a class for  */
+	/* each of them, and columns are counted with kiloCharWidth().               */
+	int ascii;
+
+	/* Where the row starts in the file on disk and how long it was there, or -1 */
+	/* for a row that is not in the file yet. Dirty rows differ from the disk.  */
+	off_t offset;
+	int origsize;
+	int dirty;
+
+	/* Set while a batch has changed chars but render has not caught up yet. */
+	int stale;
+	/* Set while chars points into memory the row does not own, which it then  */
+	/* copies the first time it is changed. Such text is not NULL terminated.  */
+	int shared;
+	/* Set instead when the text, a block or a rope, is shared with a clipboard */
+	/* and other rows, and is released by whichever lets go of it last.       */
+	struct kiloShare *share;
+	/* Number of rows after this one that are folded away under it, or 0. Left */
+	/* to the owner; the core only carries it along with the row.              */
+	int fold;
+}erow;
+
+
+
+
+
+/* Enumeration of the edits a batch is made of. A split breaks a row in two at */
+/* (row, col), the same as inserting a newline there.                          */
+enum kiloEditOp
+{
+	KILO_EDIT_INSERT = 1,
+	KILO_EDIT_DELETE,
+	KILO_EDIT_SPLIT
+};
+
+/* Structure that describes one edit of a batch. "s" and "len" are the text of */
+/* an insertion; a deletion removes "len" bytes, counting row ends as one byte. */
+struct kiloEdit
+{
+	int op;
+	int row;
+	int col;
+	const char *s;
+	int len;
+};
+
+
+
+
+
+struct kiloBuffer;
+
+/* Structure that holds the functions a buffer calls back into whoever owns it. */
+/* Any of them may be NULL.                                                      */
+struct kiloHooks
+{
+	/* Called before every insertion or deletion, while the buffer still holds */
+	/* the text. Deletions pass "s" as NULL and "len" already clipped.         */
+	void (*edit)(struct kiloBuffer *b, int op, int row, int col, const char *s, int len);
+	/* Called when rows have been added or removed at index "at". */
+	void (*shift)(struct kiloBuffer *b, int at);
+	/* Called after a row has been rendered again. */
+	void (*render)(struct kiloBuffer *b, erow *row);
+	/* Called right before a row's memory is released. */
+	void (*release)(struct kiloBuffer *b, erow *row);
+};
+
+/* Structure that holds the state of one buffer: its rows and its cursor. */
+struct kiloBuffer
+{
+	/* cx and cy will be used to control the cursor position. */
+	int cx, cy;
+
+	int numrows;
+	/* Number of rows the row array has room for. */
+	int rowcap;
+	erow *row;
+
+	/* Indices of the rows edited since the owner last cleared ndirty, and  */
+	/* whether rows have been added or removed, in which case the rows no    */
+	/* longer line up with the file on disk.                                 */
+	int *dirtyrows;
+	int ndirty;
+	int layout_changed;
+
+	/* What the row buffers and the row array really take from malloc(), and the */
+	/* number of row buffers, to estimate the allocator's own overhead.          */
+	size_t mem_chars;
+	size_t mem_render;
+	size_t mem_rows;
+	long long nalloc;
+
+	/* Nesting depth of kiloBeginBatch(). While it is not zero rows are only   */
+	/* flagged stale; the rows between stale_lo and stale_hi are rendered, and */
+	/* the hooks told, once the outermost batch ends. shift_at is the lowest   */
+	/* index rows were added or removed at, or -1.                             */
+	int batch;
+	int stale_lo;
+	int stale_hi;
+	int shift_at;
+
+	struct kiloHooks hooks;
+	/* Left alone by the core, for the owner of the buffer. */
+	void *user;
+};
+
+
+
+
+
+/* Structure that holds rows copied out of a buffer. The rows' text is not copied:  */
+/* the clipboard and the rows share it, and a row takes a copy of its own the       */
+/* first time it is changed. "mem" is what the shared text takes from malloc().     */
+struct kiloClip
+{
+	int numrows;
+	struct kiloShare **rows;
+	size_t mem;
+};
+
+
+
+
+
+/* ====[PROTOTYPES]======================================================================================================= */
+void kiloBufferInit(struct kiloBuffer *b, const struct kiloHooks *hooks);
+void kiloBufferFree(struct kiloBuffer *b);
+size_t kiloMemSize(void *p);
+
+int kiloIsAscii(const char *s, int len);
+int kiloUtf8Decode(const char *s, int len, int *cp);
+int kiloCharWidth(int cp);
+
+int kiloRowCxToRx(erow *row, int cx);
+int kiloRowRenderOffset(erow *row, int rx, int *cut);
+int kiloRowNextChar(erow *row, int cx);
+int kiloRowPrevChar(erow *row, int cx);
+int kiloRowSnap(erow *row, int cx);
+void kiloRowRead(erow *row, int from, int len, char *dst);
+const char *kiloRowPiece(erow *row, int *piece, int *len);
+int kiloRowWindow(erow *row, int col, int cols, char *dst);
+void kiloRowAppend(struct kiloBuffer *b, erow *row, const char *s, int len);
+void kiloUpdateRow(struct kiloBuffer *b, erow *row);
+void kiloInsertRows(struct kiloBuffer *b, int at, int n);
+void kiloRowSetChars(struct kiloBuffer *b, erow *row, const char *a, int alen, const char *s, int slen);
+void kiloAppendRow(struct kiloBuffer *b, const char *s, size_t len);
+void kiloAppendShared(struct kiloBuffer *b, const char *s, int len);
+void kiloRowRender(struct kiloBuffer *b, erow *row);
+void kiloRowMarkDirty(struct kiloBuffer *b, erow *row);
+
+int kiloInsertText(struct kiloBuffer *b, int row, int col, const char *s, int len, int *endrow, int *endcol);
+int kiloTextEnd(struct kiloBuffer *b, int row, int col, int len, int *endrow, int *endcol);
+char *kiloCopyText(struct kiloBuffer *b, int row, int col, int endrow, int endcol, int len);
+int kiloDeleteText(struct kiloBuffer *b, int row, int col, int len);
+int kiloReplaceRows(struct kiloBuffer *b, int at, int n, struct kiloBuffer *src);
+struct kiloClip *kiloCopyRows(struct kiloBuffer *b, int at, int n);
+int kiloPasteRows(struct kiloBuffer *b, int at, const struct kiloClip *clip);
+void kiloClipFree(struct kiloClip *clip);
+void kiloInsertChar(struct kiloBuffer *b, int c);
+void kiloDelChar(struct kiloBuffer *b);
+char *kiloRowsToString(struct kiloBuffer *b, size_t *buflen);
+
+void kiloBeginBatch(struct kiloBuffer *b);
+void kiloEndBatch(struct kiloBuffer *b);
+int kiloApply(struct kiloBuffer *b, const struct kiloEdit *edits, int n);
+
+#endif
+/* ====[END-OF-FILE]====================================================================================================== */